@@ -0,0 +1,236 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include "session.h"
+
+/*
+ * Checks that Session frames do not allocate once warmed up. operator new is hooked
+ * and counts while armed; every filter configuration below drives a vehicle through
+ * a landmark grid, warms up, then fails if any of the measured frames allocates.
+ * The same drive then goes through the websocket text path, handle_message(), which
+ * still allocates per frame outside the filter: the copy of the message and the json
+ * tree of the request, and the association strings, json tree and dump of the reply.
+ * Built with PF_ALLOC_STATS the check fails if any of those allocations falls in the
+ * prediction, update or resample stages; otherwise the count is only reported.
+ * Usage: alloc_check [warmup_frames] [frames]
+ */
+namespace
+{
+	std::atomic<bool>			armed(false);
+	std::atomic<unsigned long>	allocations(0);
+
+	void* counted(const size_t &size)
+	{
+		if (armed.load(std::memory_order_relaxed))
+			allocations.fetch_add(1, std::memory_order_relaxed);
+
+		void *ptr = std::malloc(size ? size : 1);
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+
+	struct Case
+	{
+		const char					*name;
+		AssociationType				association;
+		ResamplerType				resampler;
+		unsigned int				threads;
+		unsigned int				islands;
+		unsigned int				sort_interval;
+		double						bucket_size;
+		double						cache_margin;
+		bool						multiplicity;
+		bool						shared;			// Pool and engine from FilterResources
+	};
+
+	// Filter stages of the text path that must not allocate
+	const alloc_stats::Stage FILTER_STAGES[] = { alloc_stats::STAGE_PREDICTION, alloc_stats::STAGE_UPDATE, alloc_stats::STAGE_RESAMPLE };
+
+	const Case CASES[] =
+	{
+		{ "brute force",		ASSOCIATION_BRUTE_FORCE,	RESAMPLER_SYSTEMATIC,	1, 1, 0, 0.0, 0.0, false, false },
+		{ "kdtree",				ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	1, 1, 0, 0.0, 0.0, false, false },
+		{ "alias",				ASSOCIATION_KDTREE,			RESAMPLER_ALIAS,		1, 1, 0, 0.0, 0.0, false, false },
+		{ "metropolis",			ASSOCIATION_KDTREE,			RESAMPLER_METROPOLIS,	1, 1, 0, 0.0, 0.0, false, false },
+		{ "rejection",			ASSOCIATION_KDTREE,			RESAMPLER_REJECTION,	1, 1, 0, 0.0, 0.0, false, false },
+		{ "threads",			ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 1, 0, 0.0, 0.0, false, false },
+		{ "islands",			ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 4, 0, 0.0, 0.0, false, false },
+		{ "islands alias",		ASSOCIATION_KDTREE,			RESAMPLER_ALIAS,		2, 4, 0, 0.0, 0.0, false, false },
+		{ "sort",				ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 1, 2, 0.0, 0.0, false, false },
+		{ "bucket",				ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 1, 0, 2.0, 0.0, false, false },
+		{ "cache",				ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 1, 0, 0.0, 2.0, false, false },
+		{ "multiplicity",		ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 1, 0, 0.0, 0.0, true,  false },
+		{ "islands all",		ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 4, 3, 2.0, 2.0, true,  false },
+		{ "shared",				ASSOCIATION_KDTREE,			RESAMPLER_SYSTEMATIC,	2, 1, 0, 0.0, 0.0, false, true  }
+	};
+
+	// Vehicle on a straight line through a regular landmark grid, observations in vehicle coordinates
+	void make_frame(const Map &map, const unsigned int &f, const double &range, TelemetryFrame &frame)
+	{
+		const double velocity = 10.0, delta_t = 0.1, heading = 0.3;
+		const double x = f * velocity * delta_t * std::cos(heading);
+		const double y = f * velocity * delta_t * std::sin(heading);
+
+		frame.seq				= f;
+		frame.sent_ns			= 0;
+		frame.sense_x			= x;
+		frame.sense_y			= y;
+		frame.sense_theta		= heading;
+		frame.previous_velocity	= velocity;
+		frame.previous_yawrate	= 0.0;
+		frame.flags				= 0;
+		frame.obs_numb			= 0;
+
+		for (unsigned int i = 0; i < map.landmark_list.size() && frame.obs_numb < TELEMETRY_MAX_OBSERVATIONS; ++i)
+		{
+			const double dx = map.to_global_x(map.landmark_list[i].x_f) - x;
+			const double dy = map.to_global_y(map.landmark_list[i].y_f) - y;
+
+			if (dx * dx + dy * dy < range * range)
+			{
+				frame.obs_x[frame.obs_numb] = std::cos(heading) * dx + std::sin(heading) * dy;
+				frame.obs_y[frame.obs_numb] = std::cos(heading) * dy - std::sin(heading) * dx;
+				++frame.obs_numb;
+			}
+		}
+	}
+	// The frame as the simulator sends it over the websocket
+	std::string render(const TelemetryFrame &frame)
+	{
+		char buff[256];
+		snprintf(buff, sizeof(buff), "42[\"telemetry\",{\"sense_x\":\"%.4f\",\"sense_y\":\"%.4f\",\"sense_theta\":\"%.4f\",\"previous_velocity\":\"%.4f\",\"previous_yawrate\":\"%.4f\",",
+				 frame.sense_x, frame.sense_y, frame.sense_theta, frame.previous_velocity, frame.previous_yawrate);
+
+		std::string obs_x, obs_y;
+		for (unsigned int i = 0; i < frame.obs_numb; ++i)
+		{
+			obs_x += std::to_string(frame.obs_x[i]) + " ";
+			obs_y += std::to_string(frame.obs_y[i]) + " ";
+		}
+		return buff + ("\"sense_observations_x\":\"" + obs_x + "\",\"sense_observations_y\":\"" + obs_y + "\"}]");
+	}
+}
+
+void* operator new  (size_t size)							{ return counted(size); }
+void* operator new[](size_t size)							{ return counted(size); }
+void* operator new  (size_t size, const std::nothrow_t&) noexcept	{ try { return counted(size); } catch (...) { return nullptr; } }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept	{ try { return counted(size); } catch (...) { return nullptr; } }
+void  operator delete  (void *ptr) noexcept					{ std::free(ptr); }
+void  operator delete[](void *ptr) noexcept					{ std::free(ptr); }
+void  operator delete  (void *ptr, size_t) noexcept			{ std::free(ptr); }
+void  operator delete[](void *ptr, size_t) noexcept			{ std::free(ptr); }
+
+int main(int argc, char **argv)
+{
+	const unsigned int warmup_numb = argc > 1 ? std::atoi(argv[1]) : 50;
+	const unsigned int frames_numb = argc > 2 ? std::atoi(argv[2]) : 50;
+
+	// 20 m landmark grid around the whole drive
+	std::vector<double>		  x, y;
+	std::vector<unsigned int> id;
+	for (int i = -10; i <= 60; ++i)
+		for (int j = -10; j <= 30; ++j)
+		{
+			x.push_back(i * 20.0);
+			y.push_back(j * 20.0);
+			id.push_back(id.size() + 1);
+		}
+
+	Map map;
+	map.set_landmarks(x.data(), y.data(), id.data(), id.size());
+
+	FilterConfig cfg;
+	cfg.delta_t			 = 0.1;
+	cfg.sensor_range	 = 50;
+	cfg.particles_numb	 = 500;
+	cfg.sigma_pos		 = { 0.3, 0.3, 0.01 };
+	cfg.sigma_landmark	 = { 0.3, 0.3 };
+	cfg.publish_estimate = true;
+
+	TelemetryFrame frame;
+	PoseFrame	   pose;
+	int			   failed = 0;
+
+	for (const Case &c : CASES)
+	{
+		cfg.association			 = c.association;
+		cfg.resampler			 = c.resampler;
+		cfg.threads_numb		 = c.threads;
+		cfg.islands_numb		 = c.islands;
+		cfg.sort_interval		 = c.sort_interval;
+		cfg.bucket_size			 = c.bucket_size;
+		cfg.cache_margin		 = c.cache_margin;
+		cfg.multiplicity		 = c.multiplicity;
+
+		std::unique_ptr<FilterResources> resources(c.shared ? new FilterResources(cfg, map) : nullptr);
+		Session session(cfg, map, nullptr, resources.get());
+
+		for (unsigned int f = 0; f < warmup_numb + frames_numb; ++f)
+		{
+			make_frame(map, f, cfg.sensor_range, frame);
+
+			armed = f >= warmup_numb;
+			session.handle_frame(frame, pose);
+			armed = false;
+		}
+
+		const unsigned long count = allocations.exchange(0);
+		std::cout << (count ? "FAIL " : "ok   ") << c.name << ": " << count << " allocations in " << frames_numb << " frames" << std::endl;
+
+		failed |= count != 0;
+	}
+
+	// Text path with the first configuration, messages rendered before the hook is armed
+	{
+		const Case &c = CASES[0];
+		cfg.association	  = c.association;
+		cfg.resampler	  = c.resampler;
+		cfg.threads_numb  = c.threads;
+		cfg.islands_numb  = c.islands;
+		cfg.sort_interval = c.sort_interval;
+		cfg.bucket_size	  = c.bucket_size;
+		cfg.cache_margin  = c.cache_margin;
+		cfg.multiplicity  = c.multiplicity;
+
+		std::vector<std::string> messages(warmup_numb + frames_numb);
+		for (unsigned int f = 0; f < messages.size(); ++f)
+		{
+			make_frame(map, f, cfg.sensor_range, frame);
+			messages[f] = render(frame);
+		}
+
+		Session					session(cfg, map);
+		std::string				reply;
+		alloc_stats::Snapshot	before, after;
+
+		for (unsigned int f = 0; f < messages.size(); ++f)
+		{
+			if (f == warmup_numb)
+				alloc_stats::snapshot(before);
+
+			armed = f >= warmup_numb;
+			session.handle_message(messages[f].data(), messages[f].size(), reply);
+			armed = false;
+		}
+		alloc_stats::snapshot(after);
+
+		unsigned long filter_count = 0;
+		for (const alloc_stats::Stage &stage : FILTER_STAGES)
+			filter_count += after.stage[stage].allocs - before.stage[stage].allocs;
+
+		const unsigned long count = allocations.exchange(0);
+		if (alloc_stats::enabled)
+			std::cout << (filter_count ? "FAIL " : "ok   ") << "text: " << count << " allocations in " << frames_numb << " frames, " << filter_count << " in the filter stages" << std::endl;
+		else
+			std::cout << "info text: " << count << " allocations in " << frames_numb << " frames, build with PF_ALLOC_STATS to check the filter stages" << std::endl;
+
+		failed |= filter_count != 0;
+	}
+
+	return failed;
+}
@@ -0,0 +1,178 @@
+#include "alloc_stats.h"
+
+#include <iomanip>
+
+#ifdef PF_ALLOC_STATS
+
+#include <atomic>
+#include <cerrno>
+#include <malloc.h>
+#include <sys/resource.h>
+
+extern "C"
+{
+	void *__libc_malloc		(size_t size);
+	void *__libc_calloc		(size_t n, size_t size);
+	void *__libc_realloc	(void *ptr, size_t size);
+	void *__libc_memalign	(size_t alignment, size_t size);
+	void  __libc_free		(void *ptr);
+}
+
+namespace
+{
+	std::atomic<unsigned long>	stage_allocs[alloc_stats::STAGE_COUNT];
+	std::atomic<unsigned long>	stage_bytes [alloc_stats::STAGE_COUNT];
+	std::atomic<unsigned long>	live_bytes;
+	std::atomic<unsigned long>	peak_live_bytes;
+
+	__thread int				current_stage = alloc_stats::STAGE_OTHER;
+
+	// Must not allocate: it runs inside malloc
+	inline void account_alloc(void *ptr, const size_t &requested)
+	{
+		if (!ptr)
+			return;
+
+		stage_allocs[current_stage].fetch_add(1, std::memory_order_relaxed);
+		stage_bytes [current_stage].fetch_add(requested, std::memory_order_relaxed);
+
+		const unsigned long live = live_bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed) + malloc_usable_size(ptr);
+		unsigned long peak = peak_live_bytes.load(std::memory_order_relaxed);
+
+		while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+	}
+	inline void account_free(void *ptr)
+	{
+		if (ptr)
+			live_bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+	}
+}
+
+extern "C"
+{
+	void *malloc(size_t size)
+	{
+		void *ptr = __libc_malloc(size);
+		account_alloc(ptr, size);
+		return ptr;
+	}
+	void *calloc(size_t n, size_t size)
+	{
+		void *ptr = __libc_calloc(n, size);
+		account_alloc(ptr, n * size);
+		return ptr;
+	}
+	void *realloc(void *ptr, size_t size)
+	{
+		// A failed realloc leaves the block live, so the old size is only released once it is gone
+		const size_t old_size = ptr ? malloc_usable_size(ptr) : 0;
+		void *new_ptr = __libc_realloc(ptr, size);
+
+		if (new_ptr || size == 0)
+			live_bytes.fetch_sub(old_size, std::memory_order_relaxed);
+		account_alloc(new_ptr, size);
+		return new_ptr;
+	}
+	void *memalign(size_t alignment, size_t size)
+	{
+		void *ptr = __libc_memalign(alignment, size);
+		account_alloc(ptr, size);
+		return ptr;
+	}
+	void *aligned_alloc(size_t alignment, size_t size)
+	{
+		return memalign(alignment, size);
+	}
+	int posix_memalign(void **out, size_t alignment, size_t size)
+	{
+		if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+			return EINVAL;
+
+		void *ptr = memalign(alignment, size);
+		if (!ptr)
+			return ENOMEM;
+		*out = ptr;
+		return 0;
+	}
+	void free(void *ptr)
+	{
+		account_free(ptr);
+		__libc_free(ptr);
+	}
+}
+
+alloc_stats::Scope::Scope(const Stage &stage) : previous(current_stage)
+{
+	current_stage = stage;
+}
+alloc_stats::Scope::~Scope()
+{
+	current_stage = previous;
+}
+void alloc_stats::Scope::enter(const Stage &stage)
+{
+	current_stage = stage;
+}
+alloc_stats::Stage alloc_stats::current()
+{
+	return static_cast<Stage>(current_stage);
+}
+void alloc_stats::snapshot(Snapshot &out)
+{
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		out.stage[i].allocs = stage_allocs[i].load(std::memory_order_relaxed);
+		out.stage[i].bytes	= stage_bytes [i].load(std::memory_order_relaxed);
+	}
+	out.live_bytes		= live_bytes.load(std::memory_order_relaxed);
+	out.peak_live_bytes = peak_live_bytes.load(std::memory_order_relaxed);
+
+	struct rusage usage;
+	out.peak_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+#endif /* PF_ALLOC_STATS */
+
+const char* alloc_stats::stage_name(const Stage &stage)
+{
+	static const char* names[STAGE_COUNT] = { "other", "parse", "prediction", "update", "resample", "report" };
+	return names[stage];
+}
+void alloc_stats::Report::begin()
+{
+	snapshot(start);
+}
+void alloc_stats::Report::end()
+{
+	snapshot(latest);
+
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		total[i].allocs += latest.stage[i].allocs - start.stage[i].allocs;
+		total[i].bytes	+= latest.stage[i].bytes  - start.stage[i].bytes;
+	}
+	++samples;
+}
+void alloc_stats::Report::print(std::ostream &os, const char *unit) const
+{
+	if (!enabled || samples == 0)
+		return;
+
+	const std::ios::fmtflags	flags		= os.flags();
+	const std::streamsize		precision	= os.precision();
+
+	os << "Allocations per " << unit << " (" << samples << " samples):" << std::fixed << std::setprecision(1);
+	for (int i = 0; i < STAGE_COUNT; ++i)
+		os << " " << stage_name(static_cast<Stage>(i)) << " " << double(total[i].allocs) / samples << " (" << total[i].bytes / samples << " B)";
+
+	os << " | live " << latest.live_bytes << " B, peak " << latest.peak_live_bytes << " B, peak RSS " << latest.peak_rss_kb << " kB" << std::endl;
+
+	os.flags(flags);
+	os.precision(precision);
+}
+void alloc_stats::Report::clear()
+{
+	for (int i = 0; i < STAGE_COUNT; ++i)
+		total[i] = Counters();
+	samples = 0;
+}
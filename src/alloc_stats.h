@@ -0,0 +1,102 @@
+#ifndef __ALLOC_STATS_H__
+#define __ALLOC_STATS_H__
+
+#include <ostream>
+
+/*
+ * Allocation accounting, enabled by building with -DPF_ALLOC_STATS=ON.
+ * malloc/calloc/realloc/free are interposed (operator new goes through malloc),
+ * and every allocation is charged to the stage active on the calling thread.
+ * Without the option all of this compiles down to nothing.
+ */
+namespace alloc_stats
+{
+	enum Stage
+	{
+		STAGE_OTHER = 0,
+		STAGE_PARSE,
+		STAGE_PREDICTION,
+		STAGE_UPDATE,
+		STAGE_RESAMPLE,
+		STAGE_REPORT,
+		STAGE_COUNT
+	};
+
+	struct Counters
+	{
+		Counters() : allocs(0), bytes(0) {}
+
+		unsigned long allocs;	// Number of allocation calls
+		unsigned long bytes;	// Requested bytes
+	};
+
+	struct Snapshot
+	{
+		Snapshot() : live_bytes(0), peak_live_bytes(0), peak_rss_kb(0) {}
+
+		Counters		stage[STAGE_COUNT];
+		unsigned long	live_bytes;			// Heap bytes currently allocated
+		unsigned long	peak_live_bytes;	// High-water mark of live_bytes
+		long			peak_rss_kb;		// Process peak resident set size [kB]
+	};
+
+	const char* stage_name(const Stage &stage);
+
+#ifdef PF_ALLOC_STATS
+	static const bool enabled = true;
+
+	// Charges allocations on this thread to stage until the scope ends or enter() switches stage
+	class Scope
+	{
+	public:
+		explicit Scope(const Stage &stage);
+		~Scope();
+
+		void enter	(const Stage &stage);
+	private:
+		Scope(const Scope&);
+		Scope& operator=(const Scope&);
+
+		int previous;
+	};
+
+	// Stage charged on the calling thread, ThreadPool hands it to the workers running a loop's chunks
+	Stage current	();
+	void snapshot	(Snapshot &out);
+#else
+	static const bool enabled = false;
+
+	class Scope
+	{
+	public:
+		explicit Scope(const Stage &) {}
+
+		void enter	(const Stage &) {}
+	};
+
+	inline Stage current() { return STAGE_OTHER; }
+	inline void snapshot(Snapshot &) {}
+#endif
+
+	/*
+	 * Accumulates the per-stage deltas between two snapshots, e.g. one websocket
+	 * message or one replayed frame, and prints the running averages.
+	 */
+	class Report
+	{
+	public:
+		Report() : samples(0) {}
+
+		void begin	();
+		void end	();
+		void print	(std::ostream &os, const char *unit) const;
+		void clear	();
+	private:
+		Snapshot		start;
+		Snapshot		latest;
+		Counters		total[STAGE_COUNT];
+		unsigned long	samples;
+	};
+}
+
+#endif /* __ALLOC_STATS_H__ */
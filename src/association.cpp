@@ -0,0 +1,41 @@
+#include "association.h"
+
+void BruteForceAssociation::build(const Map &map_landmarks)
+{
+	map = &map_landmarks;
+}
+void BruteForceAssociation::in_range(const scalar_t &x, const scalar_t &y, const scalar_t &range, LandmarkSet &out) const
+{
+	const scalar_t r2 = range * range;
+
+	for (unsigned int j = 0; j < map->landmark_list.size(); ++j)
+	{
+		const Map::single_landmark_s &l = map->landmark_list[j];
+
+		if ((l.x_f - x) * (l.x_f - x) + (l.y_f - y) * (l.y_f - y) < r2)
+			out.push_back(l.x_f, l.y_f, l.id_i);
+	}
+}
+void KdTreeAssociation::build(const Map &map_landmarks)
+{
+	map = &map_landmarks;
+	tree.build(map_landmarks.landmark_list);
+}
+void KdTreeAssociation::in_range(const scalar_t &x, const scalar_t &y, const scalar_t &range, LandmarkSet &out) const
+{
+	out.indices.clear();
+	tree.radius(x, y, range * range, out.indices);
+
+	for (unsigned int j = 0; j < out.indices.size(); ++j)
+	{
+		const Map::single_landmark_s &l = map->landmark_list[out.indices[j]];
+		out.push_back(l.x_f, l.y_f, l.id_i);
+	}
+}
+AssociationEngine* make_association_engine(const AssociationType &type)
+{
+	if (type == ASSOCIATION_KDTREE)
+		return new KdTreeAssociation();
+
+	return new BruteForceAssociation();
+}
@@ -0,0 +1,108 @@
+#ifndef __ASSOCIATION_H__
+#define __ASSOCIATION_H__
+
+#include <string>
+#include <vector>
+#include "helper_functions.h"
+#include "kdtree.h"
+
+enum AssociationType
+{
+	ASSOCIATION_BRUTE_FORCE = 0,
+	ASSOCIATION_KDTREE
+};
+
+/*
+ * Landmarks returned by a range query, kept as separate arrays for the numeric kernels.
+ */
+struct LandmarkSet
+{
+	void clear()
+	{
+		x.clear();
+		y.clear();
+		id.clear();
+	}
+	void reserve(const unsigned int &n)
+	{
+		x.reserve(n);
+		y.reserve(n);
+		id.reserve(n);
+		indices.reserve(n);
+	}
+	void push_back(const scalar_t &lx, const scalar_t &ly, const int &lid)
+	{
+		x.push_back(lx);
+		y.push_back(ly);
+		id.push_back(lid);
+	}
+	unsigned int size() const { return id.size(); }
+
+	std::vector<scalar_t>	x;
+	std::vector<scalar_t>	y;
+	std::vector<int>		id;
+
+	std::vector<unsigned int> indices;	// Query scratch of the engines, kept here so queries can run concurrently
+};
+/*
+ * Spatial queries over the map landmarks used by updateWeights() and associate().
+ * Engines are built once per map and compare squared distances only; queries are
+ * const and may run from several threads at once.
+ */
+class AssociationEngine
+{
+public:
+	AssociationEngine() : map(nullptr) {}
+	virtual ~AssociationEngine() {}
+
+	virtual void build(const Map &map_landmarks) = 0;
+	/**
+	 * in_range Appends every landmark closer than range to (x, y) to out.
+	 */
+	virtual void in_range(const scalar_t &x, const scalar_t &y, const scalar_t &range, LandmarkSet &out) const = 0;
+
+	virtual const char* name() const = 0;
+	virtual AssociationType type() const = 0;
+
+	// Map the engine was built for
+	const Map* built_for() const { return map; }
+protected:
+	const Map*			map;
+};
+
+class BruteForceAssociation : public AssociationEngine
+{
+public:
+	void build		(const Map &map_landmarks);
+	void in_range	(const scalar_t &x, const scalar_t &y, const scalar_t &range, LandmarkSet &out) const;
+
+	const char* name() const { return "bruteforce"; }
+	AssociationType type() const { return ASSOCIATION_BRUTE_FORCE; }
+};
+
+class KdTreeAssociation : public AssociationEngine
+{
+public:
+	void build		(const Map &map_landmarks);
+	void in_range	(const scalar_t &x, const scalar_t &y, const scalar_t &range, LandmarkSet &out) const;
+
+	const char* name() const { return "kdtree"; }
+	AssociationType type() const { return ASSOCIATION_KDTREE; }
+private:
+	KdTree						tree;
+};
+
+AssociationEngine* make_association_engine(const AssociationType &type);
+
+struct String2Association
+{
+	AssociationType operator()(const std::string &str) const
+	{
+		if (str == "kdtree")
+			return ASSOCIATION_KDTREE;
+
+		return ASSOCIATION_BRUTE_FORCE;
+	}
+};
+
+#endif /* __ASSOCIATION_H__ */
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include "association.h"
+
+/*
+ * Compares the brute-force and k-d tree association engines on random maps of
+ * growing size over a fixed area, and reports where the k-d tree starts to win.
+ * The brute-force cost grows with the whole map, the k-d tree one with the landmarks visible.
+ * Usage: association_bench [sensor_range] [queries]
+ */
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double time_queries(AssociationEngine &engine, const std::vector<LandmarkObs> &queries, const scalar_t &range, double &visible)
+	{
+		LandmarkSet out;
+		out.reserve(1024);
+
+		unsigned long found = 0;
+		const Clock::time_point start = Clock::now();
+
+		for (unsigned int i = 0; i < queries.size(); ++i)
+		{
+			out.clear();
+			engine.in_range(queries[i].x, queries[i].y, range, out);
+			found += out.size();
+		}
+
+		const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		visible = double(found) / queries.size();
+
+		return ns / queries.size();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const scalar_t		sensor_range	= argc > 1 ? std::atof(argv[1]) : 50.0;
+	const unsigned int	queries_numb	= argc > 2 ? std::atoi(argv[2]) : 20000;
+	const scalar_t		half_size		= 500.0;
+
+	std::mt19937 gen(42);
+	std::uniform_real_distribution<scalar_t> coord(-half_size, half_size);
+
+	std::vector<LandmarkObs> queries(queries_numb);
+	for (unsigned int i = 0; i < queries_numb; ++i)
+		queries[i] = LandmarkObs(coord(gen), coord(gen), 0);
+
+	std::cout << "landmarks  visible  bruteforce[ns]  kdtree[ns]  speedup" << std::endl;
+
+	unsigned int crossover = 0;
+	double		 crossover_visible = 0.0;
+	for (unsigned int landmarks_numb = 4; landmarks_numb <= 200000; landmarks_numb *= 2)
+	{
+		Map map;
+		map.landmark_list.resize(landmarks_numb);
+		for (unsigned int i = 0; i < landmarks_numb; ++i)
+		{
+			map.landmark_list[i].id_i = i + 1;
+			map.landmark_list[i].x_f  = coord(gen);
+			map.landmark_list[i].y_f  = coord(gen);
+		}
+
+		BruteForceAssociation brute_force;
+		KdTreeAssociation	  kdtree;
+		brute_force.build(map);
+		kdtree.build(map);
+
+		double visible = 0.0;
+		const double brute_ns = time_queries(brute_force, queries, sensor_range, visible);
+		const double kd_ns	  = time_queries(kdtree,	  queries, sensor_range, visible);
+
+		// Crossover is the first size from which the k-d tree stays faster
+		if (kd_ns >= brute_ns)
+			crossover = 0;
+		else if (crossover == 0)
+		{
+			crossover		  = landmarks_numb;
+			crossover_visible = visible;
+		}
+
+		std::cout << std::setw(9) << landmarks_numb << std::setw(9) << std::fixed << std::setprecision(1) << visible
+				  << std::setw(16) << brute_ns << std::setw(12) << kd_ns << std::setw(9) << std::setprecision(2) << brute_ns / kd_ns << std::endl;
+	}
+
+	if (crossover != 0)
+		std::cout << "k-d tree is faster from " << crossover << " map landmarks (" << std::setprecision(1) << crossover_visible << " visible per query)" << std::endl;
+
+	return 0;
+}
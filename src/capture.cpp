@@ -0,0 +1,123 @@
+#include "capture.h"
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	const char		CAPTURE_MAGIC[8]	= { 'P', 'F', 'C', 'A', 'P', '0', '1', '\0' };
+	const uint32_t	MAX_PAYLOAD			= 256 * 1024 * 1024;	// Beyond any telemetry frame or filter checkpoint, as for shard messages
+}
+
+CaptureWriter::CaptureWriter() : file(nullptr), start_ns(0), next_session(1) {}
+
+CaptureWriter::~CaptureWriter()
+{
+	close();
+}
+uint64_t CaptureWriter::now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+bool CaptureWriter::open(const std::string &path)
+{
+	close();
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	file = std::fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	// Large buffer, a flush per frame would put a syscall back on the hot path
+	std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+	CaptureHeader head;
+	std::memcpy(head.magic, CAPTURE_MAGIC, sizeof(head.magic));
+	head.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+	start_ns = now_ns();
+	return std::fwrite(&head, sizeof(head), 1, file) == 1;
+}
+void CaptureWriter::close()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (file)
+		std::fclose(file);
+
+	file = nullptr;
+}
+uint32_t CaptureWriter::open_session()
+{
+	const uint32_t session = next_session++;
+	record(session, CAPTURE_OPEN, nullptr, 0);
+	return session;
+}
+void CaptureWriter::close_session(const uint32_t &session)
+{
+	record(session, CAPTURE_CLOSE, nullptr, 0);
+}
+void CaptureWriter::record(const uint32_t &session, const CaptureKind &kind, const char *data, const size_t &length)
+{
+	CaptureRecord rec;
+	rec.t_ns	 = now_ns() - start_ns;
+	rec.session	 = session;
+	rec.kind	 = kind;
+	rec.length	 = length;
+	rec.reserved = 0;
+
+	record(rec, data);
+}
+void CaptureWriter::record(const CaptureRecord &rec, const char *data)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!file)
+		return;
+
+	std::fwrite(&rec, sizeof(rec), 1, file);
+
+	if (rec.length)
+		std::fwrite(data, 1, rec.length, file);
+}
+
+CaptureReader::CaptureReader() : file(nullptr), size(-1) {}
+
+CaptureReader::~CaptureReader()
+{
+	if (file)
+		std::fclose(file);
+}
+bool CaptureReader::open(const std::string &path)
+{
+	if (file)
+		std::fclose(file);
+
+	file = std::fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	if (std::fread(&head, sizeof(head), 1, file) != 1 || std::memcmp(head.magic, CAPTURE_MAGIC, sizeof(head.magic)) != 0)
+	{
+		std::fclose(file);
+		file = nullptr;
+		return false;
+	}
+
+	// Unknown for unseekable files, only MAX_PAYLOAD bounds their records then
+	size = std::fseek(file, 0, SEEK_END) == 0 ? std::ftell(file) : -1;
+	std::fseek(file, sizeof(head), SEEK_SET);
+	return true;
+}
+bool CaptureReader::next(CaptureRecord &rec, std::vector<char> &payload)
+{
+	if (!file || std::fread(&rec, sizeof(rec), 1, file) != 1)
+		return false;
+
+	// A corrupt or cut off record must not make the payload allocation run away
+	if (rec.length > MAX_PAYLOAD || (size >= 0 && rec.length > size - std::ftell(file)))
+		return false;
+
+	payload.resize(rec.length);
+	return rec.length == 0 || std::fread(payload.data(), 1, rec.length, file) == rec.length;
+}
@@ -0,0 +1,97 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Binary capture of incoming telemetry. A file is a CaptureHeader followed by records,
+ * each a CaptureRecord and `length` payload bytes, all in host byte order. Payloads are
+ * the frames exactly as the sessions received them: socket.io text for websockets and
+ * the telemetry.h wire encoding for the binary transports.
+ */
+enum CaptureKind
+{
+	CAPTURE_OPEN = 0,			// Session created, no payload
+	CAPTURE_CLOSE,				// Session destroyed, no payload
+	CAPTURE_TEXT,				// Socket.io text message
+	CAPTURE_FRAME,				// Encoded TelemetryFrame
+	CAPTURE_STATE,				// Filter checkpoint the following frames start from (flight recorder dumps)
+	CAPTURE_TIMING				// Recorded stage timings of the preceding frame, double[alloc_stats::STAGE_COUNT] [ns]
+};
+
+struct CaptureHeader
+{
+	char						magic[8];			// "PFCAP01\0"
+	uint64_t					wall_ns;			// Unix time of the first record [ns]
+};
+
+struct CaptureRecord
+{
+	uint64_t					t_ns;				// Receive time since the start of the capture [ns]
+	uint32_t					session;
+	uint32_t					kind;				// CaptureKind
+	uint32_t					length;				// Payload bytes following the record
+	uint32_t					reserved;
+};
+
+/*
+ * Thread-safe writer shared by every session and transport. Records go through a
+ * stdio buffer, so the hot path costs a lock and a memcpy.
+ */
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	bool open				(const std::string &path);
+	void close				();
+	/**
+	 * open_session Allocates a session id and records its creation.
+	 */
+	uint32_t open_session	();
+
+	void close_session		(const uint32_t &session);
+	/**
+	 * record Appends one received payload, timestamped now.
+	 */
+	void record				(const uint32_t &session, const CaptureKind &kind, const char *data, const size_t &length);
+	/**
+	 * record Appends one record with an explicit timestamp, used to rewrite captures.
+	 */
+	void record				(const CaptureRecord &rec, const char *data);
+private:
+	static uint64_t now_ns	();
+
+	std::mutex					mutex;
+	FILE						*file;
+	uint64_t					start_ns;
+	std::atomic<uint32_t>		next_session;
+};
+
+class CaptureReader
+{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	bool open				(const std::string &path);
+	/**
+	 * next Reads the following record and its payload.
+	 * @output False at the end of the file or on a truncated or oversized record
+	 */
+	bool next				(CaptureRecord &rec, std::vector<char> &payload);
+
+	const CaptureHeader& header() const { return head; }
+private:
+	FILE						*file;
+	long						size;				// File size, -1 if unknown
+	CaptureHeader				head;
+};
+
+#endif /* __CAPTURE_H__ */
@@ -0,0 +1,649 @@
+#include "distributed.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t		MAX_MESSAGE		= 256 * 1024 * 1024;
+	const int			IO_TIMEOUT_S	= 2;	// A worker silent for this long is dropped
+	const int			RETRY_MS		= 1000;	// Between reconnection attempts
+
+#ifdef MSG_NOSIGNAL
+	const int			SEND_FLAGS		= MSG_NOSIGNAL;
+#else
+	const int			SEND_FLAGS		= 0;
+#endif
+
+	bool read_all(const int &fd, char *data, size_t length)
+	{
+		while (length)
+		{
+			const ssize_t n = recv(fd, data, length, 0);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+
+			data   += n;
+			length -= n;
+		}
+		return true;
+	}
+	void to_shard(const Particle &p, ShardParticle &out)
+	{
+		out.x		 = p.x;
+		out.y		 = p.y;
+		out.theta	 = p.theta;
+		out.weight	 = p.weight;
+		out.id		 = p.id;
+		out.reserved = 0;
+	}
+	void from_shard(const ShardParticle &p, Particle &out)
+	{
+		out.x		= p.x;
+		out.y		= p.y;
+		out.theta	= p.theta;
+		out.weight	= p.weight;
+		out.id		= p.id;
+	}
+	void configure_socket(const int &fd)
+	{
+		const int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	}
+}
+
+bool shard_io::send_message(const int &fd, const uint32_t &type, const void *body, const size_t &length)
+{
+	// The length prefix counts the type and the body
+	const uint32_t header[2] = { uint32_t(sizeof(uint32_t) + length), type };
+
+	iovec iov[2];
+	iov[0].iov_base = const_cast<uint32_t*>(header);
+	iov[0].iov_len	= sizeof(header);
+	iov[1].iov_base = const_cast<void*>(body);
+	iov[1].iov_len	= length;
+
+	msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov	   = iov;
+	msg.msg_iovlen = 2;
+
+	while (msg.msg_iovlen)
+	{
+		ssize_t n = sendmsg(fd, &msg, SEND_FLAGS);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		while (msg.msg_iovlen && size_t(n) >= msg.msg_iov->iov_len)
+		{
+			n -= msg.msg_iov->iov_len;
+			++msg.msg_iov;
+			--msg.msg_iovlen;
+		}
+		if (msg.msg_iovlen)
+		{
+			msg.msg_iov->iov_base  = static_cast<char*>(msg.msg_iov->iov_base) + n;
+			msg.msg_iov->iov_len  -= n;
+		}
+	}
+	return true;
+}
+bool shard_io::recv_message(const int &fd, uint32_t &type, std::vector<char> &body)
+{
+	uint32_t header[2];
+	if (!read_all(fd, reinterpret_cast<char*>(header), sizeof(header)) || header[0] < sizeof(uint32_t) || header[0] > MAX_MESSAGE)
+		return false;
+
+	type = header[1];
+	body.resize(header[0] - sizeof(uint32_t));
+
+	return body.empty() || read_all(fd, body.data(), body.size());
+}
+
+DistributedFilter::DistributedFilter(const std::vector<std::string> &worker_addresses, const Map &map_landmarks) : map(map_landmarks), particles_numb(0), publish_estimate(false), is_initialized(false)
+{
+	std::random_device rd;
+	gen.seed(rd());
+
+	std::memset(&init_msg, 0, sizeof(init_msg));
+	std::memset(&step_msg, 0, sizeof(step_msg));
+
+	for (unsigned int i = 0; i < worker_addresses.size(); ++i)
+	{
+		const size_t colon = worker_addresses[i].rfind(':');
+		if (colon == std::string::npos)
+		{
+			std::cerr << "Worker " << worker_addresses[i] << " is not host:port, ignored" << std::endl;
+			continue;
+		}
+
+		Worker worker;
+		worker.host = worker_addresses[i].substr(0, colon);
+		worker.port = std::atoi(worker_addresses[i].c_str() + colon + 1);
+		workers.push_back(worker);
+	}
+
+	// Reconnected workers take their old slot, so resampling never resizes these
+	counts.resize(workers.size());
+	shares.resize(workers.size());
+}
+DistributedFilter::~DistributedFilter()
+{
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		if (workers[i].fd >= 0)
+			close(workers[i].fd);
+}
+bool DistributedFilter::connect(Worker &worker)
+{
+	worker.retry = Clock::now() + std::chrono::milliseconds(RETRY_MS);
+
+	addrinfo hints, *result = nullptr;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family	  = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(worker.host.c_str(), std::to_string(worker.port).c_str(), &hints, &result) != 0)
+		return false;
+
+	for (addrinfo *ai = result; ai && worker.fd < 0; ai = ai->ai_next)
+	{
+		const int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+
+		// Connect, send and receive all time out, so a hung worker cannot stall the vehicle
+		timeval timeout = { IO_TIMEOUT_S, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		if (::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		configure_socket(fd);
+		worker.fd = fd;
+	}
+	freeaddrinfo(result);
+
+	return worker.fd >= 0;
+}
+void DistributedFilter::drop(Worker &worker)
+{
+	std::cerr << "Worker " << worker.host << ":" << worker.port << " lost, " << worker.particles_numb << " particles dropped" << std::endl;
+
+	close(worker.fd);
+	worker.fd			  = -1;
+	worker.particles_numb = 0;
+	worker.retry		  = Clock::now() + std::chrono::milliseconds(RETRY_MS);
+}
+bool DistributedFilter::send_init(Worker &worker, const unsigned int &shard_numb)
+{
+	init_msg.particles_numb = shard_numb;
+
+	if (!shard_io::send_message(worker.fd, SHARD_INIT, &init_msg, sizeof(init_msg)))
+	{
+		drop(worker);
+		return false;
+	}
+	worker.particles_numb = shard_numb;
+	return true;
+}
+void DistributedFilter::reconnect()
+{
+	const Clock::time_point now = Clock::now();
+
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		Worker &worker = workers[i];
+
+		if (worker.fd < 0 && now >= worker.retry && connect(worker))
+		{
+			std::cerr << "Worker " << worker.host << ":" << worker.port << " connected" << std::endl;
+			send_init(worker, 0);
+		}
+	}
+}
+void DistributedFilter::init(const unsigned int &total_numb, const double &x, const double &y, const double &theta, const FilterConfig &cfg)
+{
+	particles_numb	 = total_numb;
+	publish_estimate = cfg.publish_estimate;
+
+	init_msg.landmarks_numb		= map.landmark_list.size();
+	init_msg.association		= cfg.association;
+	init_msg.threads_numb		= cfg.threads_numb;
+	init_msg.islands_numb		= cfg.islands_numb;
+	init_msg.migration_interval = cfg.migration_interval;
+	init_msg.numa				= cfg.numa ? 1 : 0;
+	init_msg.resampler			= cfg.resampler;
+	init_msg.resampler_iterations = cfg.resampler_iterations;
+	init_msg.sort_interval		= cfg.sort_interval;
+	init_msg.bucket_size		= cfg.bucket_size;
+	init_msg.cache_margin		= cfg.cache_margin;
+	init_msg.multiplicity		= cfg.multiplicity ? 1 : 0;
+	init_msg.migration_rate		= cfg.migration_rate;
+	init_msg.x					= x;
+	init_msg.y					= y;
+	init_msg.theta				= theta;
+	init_msg.sensor_range		= cfg.sensor_range;
+
+	for (unsigned int i = 0; i < 3; ++i)
+		init_msg.sigma_pos[i] = cfg.sigma_pos[i];
+	for (unsigned int i = 0; i < 2; ++i)
+		init_msg.sigma_landmark[i] = cfg.sigma_landmark[i];
+
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		if (workers[i].fd < 0)
+			connect(workers[i]);
+
+	const unsigned int alive = workers_alive();
+
+	// Even split, the first total % alive shards take one particle more
+	for (unsigned int i = 0, k = 0; i < workers.size(); ++i)
+	{
+		if (workers[i].fd < 0)
+			continue;
+
+		send_init(workers[i], static_cast<unsigned long>(k + 1) * particles_numb / alive - static_cast<unsigned long>(k) * particles_numb / alive);
+		++k;
+	}
+
+	step_msg.predict = 0;
+	is_initialized	 = size() != 0;
+
+	if (!is_initialized)
+		std::cerr << "No worker reachable, the distributed filter is not initialized" << std::endl;
+}
+void DistributedFilter::prediction(const double &delta_t, const double &velocity, const double &yaw_rate)
+{
+	step_msg.predict  = 1;
+	step_msg.delta_t  = delta_t;
+	step_msg.velocity = velocity;
+	step_msg.yaw_rate = yaw_rate;
+}
+void DistributedFilter::updateWeights(const std::vector<LandmarkObs> &observations)
+{
+	reconnect();
+
+	const unsigned int n_obs = observations.size();
+	step_msg.n_obs	  = n_obs;
+	step_msg.estimate = publish_estimate ? 1 : 0;
+
+	buffer.resize(sizeof(step_msg) + 2 * n_obs * sizeof(double));
+	std::memcpy(buffer.data(), &step_msg, sizeof(step_msg));
+
+	double *obs = reinterpret_cast<double*>(buffer.data() + sizeof(step_msg));
+	for (unsigned int j = 0; j < n_obs; ++j)
+	{
+		obs[j]		   = observations[j].x;
+		obs[n_obs + j] = observations[j].y;
+	}
+
+	// Every shard gets the frame before any reply is read, so the shards run concurrently
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		if (workers[i].fd >= 0 && !shard_io::send_message(workers[i].fd, SHARD_STEP, buffer.data(), buffer.size()))
+			drop(workers[i]);
+
+	uint32_t type = 0;
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		Worker &worker = workers[i];
+		if (worker.fd < 0)
+			continue;
+
+		if (!shard_io::recv_message(worker.fd, type, buffer) || type != SHARD_WEIGHTS || buffer.size() != sizeof(ShardWeights))
+		{
+			drop(worker);
+			continue;
+		}
+		std::memcpy(&worker.weights, buffer.data(), sizeof(ShardWeights));
+		worker.particles_numb = worker.weights.particles_numb;
+	}
+
+	// With every shard lost the next frame starts over from GPS
+	if (size() == 0)
+		is_initialized = false;
+}
+Particle DistributedFilter::get_best_particle(PoseEstimate *estimate) const
+{
+	Particle best;
+	double	 best_weight = -1.0;
+	double	 total		 = 0.0, s = 0.0, c = 0.0;
+
+	if (estimate)
+		*estimate = PoseEstimate();
+
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		const Worker &worker = workers[i];
+		if (worker.fd < 0 || worker.particles_numb == 0)
+			continue;
+
+		if (worker.weights.best.weight > best_weight)
+		{
+			best_weight = worker.weights.best.weight;
+			from_shard(worker.weights.best, best);
+		}
+
+		const double w = worker.weights.weight_sum;
+		if (estimate && w > 0.0)
+		{
+			total		 += w;
+			estimate->x  += w * worker.weights.mean[0];
+			estimate->y  += w * worker.weights.mean[1];
+			s			 += w * std::sin(worker.weights.mean[2]);
+			c			 += w * std::cos(worker.weights.mean[2]);
+		}
+	}
+
+	if (!estimate)
+		return best;
+
+	if (total <= 0.0)
+	{
+		estimate->x		= best.x;
+		estimate->y		= best.y;
+		estimate->theta = best.theta;
+		return best;
+	}
+
+	estimate->x		/= total;
+	estimate->y		/= total;
+	estimate->theta  = std::atan2(s, c);
+
+	// Law of total covariance: the shard covariances plus the spread of the shard means
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		const Worker &worker = workers[i];
+		const double  w		 = worker.weights.weight_sum / total;
+
+		if (worker.fd < 0 || worker.particles_numb == 0 || w <= 0.0)
+			continue;
+
+		const double d[3] = { worker.weights.mean[0] - estimate->x, worker.weights.mean[1] - estimate->y, std::remainder(worker.weights.mean[2] - estimate->theta, 2.0 * PI) };
+
+		for (unsigned int r = 0; r < 3; ++r)
+			for (unsigned int k = 0; k < 3; ++k)
+				estimate->cov[r * 3 + k] += w * (worker.weights.cov[r * 3 + k] + d[r] * d[k]);
+	}
+	return best;
+}
+void DistributedFilter::resample()
+{
+	const unsigned int alive = workers_alive();
+	if (alive == 0)
+		return;
+
+	// Shard weights, or shard sizes when every weight vanished
+	double total = 0.0;
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		if (workers[i].fd >= 0)
+			total += workers[i].weights.weight_sum;
+
+	const bool by_weight = total > 0.0;
+	if (!by_weight)
+		total = size();
+
+	if (total <= 0.0)
+		return;
+
+	// The new shard sizes are one systematic draw over the cumulative shard weights, they add up to particles_numb
+	std::uniform_real_distribution<double> dist_offset(0.0, 1.0);
+	const double offset = dist_offset(gen);
+
+	double		 cumulative = 0.0;
+	unsigned int previous	= 0;
+
+	exchange.clear();
+
+	std::fill(counts.begin(), counts.end(), 0);
+	std::fill(shares.begin(), shares.end(), 0);
+	for (unsigned int i = 0, k = 0; i < workers.size(); ++i)
+	{
+		Worker &worker = workers[i];
+		if (worker.fd < 0)
+			continue;
+
+		cumulative += by_weight ? worker.weights.weight_sum : worker.particles_numb;
+
+		const unsigned int next = std::min<double>(particles_numb, std::floor(cumulative / total * particles_numb + offset));
+		counts[i] = next - previous;
+		previous  = next;
+
+		// Balanced size of this shard
+		shares[i] = static_cast<unsigned long>(k + 1) * particles_numb / alive - static_cast<unsigned long>(k) * particles_numb / alive;
+		++k;
+
+		const ShardResample msg = { counts[i], counts[i] > shares[i] ? counts[i] - shares[i] : 0 };
+		if (!shard_io::send_message(worker.fd, SHARD_RESAMPLE, &msg, sizeof(msg)))
+			drop(worker);
+	}
+
+	// Shards above their balanced size hand the surplus back
+	uint32_t type = 0;
+	for (unsigned int i = 0; i < workers.size(); ++i)
+	{
+		Worker &worker = workers[i];
+		if (worker.fd < 0)
+			continue;
+
+		if (!shard_io::recv_message(worker.fd, type, buffer) || type != SHARD_PARTICLES || buffer.size() % sizeof(ShardParticle) != 0)
+		{
+			drop(worker);
+			continue;
+		}
+
+		const unsigned int exported = buffer.size() / sizeof(ShardParticle);
+		const ShardParticle *particles = reinterpret_cast<const ShardParticle*>(buffer.data());
+
+		exchange.insert(exchange.end(), particles, particles + exported);
+		worker.particles_numb = counts[i] - std::min(counts[i], exported);
+	}
+
+	// ... which fills the shards below it, including reconnected empty ones
+	unsigned int used = 0;
+	for (unsigned int i = 0; i < workers.size() && used < exchange.size(); ++i)
+	{
+		Worker &worker = workers[i];
+		if (worker.fd < 0 || worker.particles_numb >= shares[i])
+			continue;
+
+		const unsigned int n = std::min<size_t>(shares[i] - worker.particles_numb, exchange.size() - used);
+
+		if (!shard_io::send_message(worker.fd, SHARD_PARTICLES, exchange.data() + used, n * sizeof(ShardParticle)))
+		{
+			drop(worker);
+			continue;
+		}
+		worker.particles_numb += n;
+		used				  += n;
+	}
+}
+bool DistributedFilter::initialized() const
+{
+	return is_initialized;
+}
+unsigned int DistributedFilter::size() const
+{
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		if (workers[i].fd >= 0)
+			n += workers[i].particles_numb;
+	return n;
+}
+unsigned int DistributedFilter::workers_alive() const
+{
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		if (workers[i].fd >= 0)
+			++n;
+	return n;
+}
+
+ShardServer::~ShardServer()
+{
+	if (listen_fd >= 0)
+		close(listen_fd);
+}
+bool ShardServer::listen_tcp(const unsigned int &port)
+{
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family		 = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port		 = htons(port);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return false;
+
+	const int on = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	return bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 && listen(listen_fd, SOMAXCONN) == 0;
+}
+void ShardServer::run()
+{
+	for (;;)
+	{
+		const int fd = accept(listen_fd, nullptr, nullptr);
+		if (fd < 0 && errno == EINTR)
+			continue;
+		if (fd < 0)
+			return;
+
+		configure_socket(fd);
+		std::thread(&ShardServer::serve, this, fd).detach();
+	}
+}
+void ShardServer::serve(const int fd) const
+{
+	std::unique_ptr<ParticleFilter> pf;
+	ShardInit						cfg;
+	FilterConfig					filter_cfg;
+	std::vector<double>				sigma_pos, sigma_landmark;
+	std::vector<scalar_t>			obs_x, obs_y;
+	std::vector<Particle>			particles;
+	std::vector<ShardParticle>		out;
+	std::vector<char>				body;
+	uint32_t						type = 0;
+
+	while (shard_io::recv_message(fd, type, body))
+	{
+		if (type == SHARD_INIT && body.size() == sizeof(ShardInit))
+		{
+			std::memcpy(&cfg, body.data(), sizeof(cfg));
+
+			if (cfg.landmarks_numb != map.landmark_list.size())
+			{
+				std::cerr << "Coordinator map has " << cfg.landmarks_numb << " landmarks, this worker " << map.landmark_list.size() << ", closing" << std::endl;
+				break;
+			}
+
+			sigma_pos.assign(cfg.sigma_pos, cfg.sigma_pos + 3);
+			sigma_landmark.assign(cfg.sigma_landmark, cfg.sigma_landmark + 2);
+
+			filter_cfg.association			= AssociationType(cfg.association);
+			filter_cfg.threads_numb			= cfg.threads_numb;
+			filter_cfg.islands_numb			= cfg.islands_numb;
+			filter_cfg.migration_interval	= cfg.migration_interval;
+			filter_cfg.migration_rate		= cfg.migration_rate;
+			filter_cfg.numa					= cfg.numa != 0;
+			filter_cfg.resampler			= ResamplerType(cfg.resampler);
+			filter_cfg.resampler_iterations	= cfg.resampler_iterations;
+			filter_cfg.sort_interval		= cfg.sort_interval;
+			filter_cfg.bucket_size			= cfg.bucket_size;
+			filter_cfg.cache_margin			= cfg.cache_margin;
+			filter_cfg.multiplicity			= cfg.multiplicity != 0;
+
+			pf.reset(new ParticleFilter());
+			configure(*pf, filter_cfg);
+			pf->init(cfg.particles_numb, cfg.x, cfg.y, cfg.theta, sigma_pos);
+		}
+		else if (type == SHARD_STEP && pf && body.size() >= sizeof(ShardStep))
+		{
+			ShardStep step;
+			std::memcpy(&step, body.data(), sizeof(step));
+
+			if (body.size() != sizeof(ShardStep) + 2 * step.n_obs * sizeof(double))
+				break;
+
+			const double *obs = reinterpret_cast<const double*>(body.data() + sizeof(ShardStep));
+			obs_x.assign(obs, obs + step.n_obs);
+			obs_y.assign(obs + step.n_obs, obs + 2 * step.n_obs);
+
+			if (step.predict)
+				pf->prediction(step.delta_t, sigma_pos, step.velocity, step.yaw_rate);
+
+			pf->updateWeights(cfg.sensor_range, sigma_landmark, obs_x.data(), obs_y.data(), step.n_obs, map);
+
+			ShardWeights reply;
+			std::memset(&reply, 0, sizeof(reply));
+
+			PoseEstimate	   estimate;
+			const unsigned int best = pf->get_best_particle(step.estimate ? &estimate : nullptr);
+
+			reply.particles_numb = pf->size();
+			reply.weight_sum	 = pf->total_weight();
+			reply.mean[0]		 = estimate.x;
+			reply.mean[1]		 = estimate.y;
+			reply.mean[2]		 = estimate.theta;
+			std::memcpy(reply.cov, estimate.cov, sizeof(reply.cov));
+
+			if (pf->size())
+				to_shard(pf->particle(best), reply.best);
+
+			if (!shard_io::send_message(fd, SHARD_WEIGHTS, &reply, sizeof(reply)))
+				break;
+		}
+		else if (type == SHARD_RESAMPLE && pf && body.size() == sizeof(ShardResample))
+		{
+			ShardResample msg;
+			std::memcpy(&msg, body.data(), sizeof(msg));
+
+			pf->resample(msg.particles_numb);
+
+			particles.clear();
+			pf->take_particles(msg.export_numb, particles);
+
+			out.resize(particles.size());
+			for (unsigned int i = 0; i < particles.size(); ++i)
+				to_shard(particles[i], out[i]);
+
+			if (!shard_io::send_message(fd, SHARD_PARTICLES, out.data(), out.size() * sizeof(ShardParticle)))
+				break;
+		}
+		else if (type == SHARD_PARTICLES && pf && body.size() % sizeof(ShardParticle) == 0)
+		{
+			const ShardParticle *in = reinterpret_cast<const ShardParticle*>(body.data());
+
+			particles.resize(body.size() / sizeof(ShardParticle));
+			for (unsigned int i = 0; i < particles.size(); ++i)
+				from_shard(in[i], particles[i]);
+
+			pf->add_particles(particles.data(), particles.size());
+		}
+		else
+			break;
+	}
+	close(fd);
+}
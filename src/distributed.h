@@ -0,0 +1,193 @@
+#ifndef __DISTRIBUTED_H__
+#define __DISTRIBUTED_H__
+
+#include <chrono>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "session.h"
+
+/*
+ * Particle filter sharded over pf_worker processes. The coordinator (one per vehicle
+ * Session) holds no particles: each worker owns a shard, runs prediction and the weight
+ * update on it and answers with its weight sum, best particle and pose estimate.
+ * Resampling is distributed: the coordinator draws every shard's new particle count
+ * from the shard weight sums, each worker resamples locally to that count, and only the
+ * particles needed to even out the shard sizes travel, through the coordinator.
+ * A worker that drops out loses its shard; it is reconnected once it is back and filled
+ * up by the next balancing. Messages use the uint32 length prefix of telemetry.h.
+ */
+enum ShardMessage
+{
+	SHARD_INIT = 1,		// ShardInit, no reply
+	SHARD_STEP,			// ShardStep + n_obs x + n_obs y, answered with SHARD_WEIGHTS
+	SHARD_WEIGHTS,		// ShardWeights
+	SHARD_RESAMPLE,		// ShardResample, answered with SHARD_PARTICLES
+	SHARD_PARTICLES		// ShardParticle array; sent to a worker, the particles are added to its shard
+};
+
+// Particles travel as doubles whatever the scalar policy of either end
+struct ShardParticle
+{
+	double				x;
+	double				y;
+	double				theta;
+	double				weight;
+	int32_t				id;
+	uint32_t			reserved;
+};
+
+struct ShardInit
+{
+	uint32_t			particles_numb;
+	uint32_t			landmarks_numb;		// Map check, a worker with another map drops the connection
+	uint32_t			association;
+	uint32_t			threads_numb;
+	uint32_t			islands_numb;
+	uint32_t			migration_interval;
+	uint32_t			numa;
+	uint32_t			resampler;
+	uint32_t			resampler_iterations;
+	uint32_t			sort_interval;
+	uint32_t			multiplicity;
+	uint32_t			reserved;
+	double				migration_rate;
+	double				bucket_size;
+	double				cache_margin;
+	double				x;					// Relative to the map origin [m]
+	double				y;
+	double				theta;
+	double				sigma_pos[3];
+	double				sensor_range;
+	double				sigma_landmark[2];
+};
+
+struct ShardStep
+{
+	uint32_t			predict;			// 0 on the frame right after SHARD_INIT
+	uint32_t			estimate;			// Whether mean and cov are wanted
+	uint32_t			n_obs;
+	uint32_t			reserved;
+	double				delta_t;
+	double				velocity;
+	double				yaw_rate;
+};
+
+struct ShardWeights
+{
+	uint32_t			particles_numb;
+	uint32_t			reserved;
+	double				weight_sum;
+	ShardParticle		best;
+	double				mean[3];			// Weighted mean pose of the shard
+	double				cov[9];
+};
+
+struct ShardResample
+{
+	uint32_t			particles_numb;		// Shard size after resampling
+	uint32_t			export_numb;		// Particles to hand back for balancing
+};
+
+namespace shard_io
+{
+	bool send_message	(const int &fd, const uint32_t &type, const void *body, const size_t &length);
+	bool recv_message	(const int &fd, uint32_t &type, std::vector<char> &body);
+}
+
+/*
+ * Coordinator side, mirrors the ParticleFilter calls Session makes per frame.
+ */
+class DistributedFilter
+{
+public:
+	/**
+	 * DistributedFilter
+	 * @param workers host:port of every pf_worker
+	 */
+	DistributedFilter(const std::vector<std::string> &workers, const Map &map);
+	~DistributedFilter();
+	/**
+	 * init Connects the workers and splits particles_numb particles evenly over them.
+	 */
+	void init(const unsigned int &particles_numb, const double &x, const double &y, const double &theta, const FilterConfig &cfg);
+	/**
+	 * prediction Keeps the control, the workers apply it along with the next updateWeights().
+	 */
+	void prediction(const double &delta_t, const double &velocity, const double &yaw_rate);
+	/**
+	 * updateWeights Sends the frame to every shard and merges the replies.
+	 */
+	void updateWeights(const std::vector<LandmarkObs> &observations);
+	/**
+	 * get_best_particle Best particle over all shards, estimate merged from the shard estimates.
+	 */
+	Particle get_best_particle(PoseEstimate *estimate = nullptr) const;
+	/**
+	 * resample Distributed resampling, see the class comment.
+	 */
+	void resample();
+	/**
+	 * initialized False until init(), and again once every shard is lost.
+	 */
+	bool initialized() const;
+
+	unsigned int size() const;
+	unsigned int workers_alive() const;
+private:
+	struct Worker
+	{
+		Worker() : port(0), fd(-1), particles_numb(0) {}
+
+		std::string					host;
+		unsigned int				port;
+		int							fd;
+		unsigned int				particles_numb;
+		ShardWeights				weights;
+		std::chrono::steady_clock::time_point retry;	// Next reconnection attempt
+	};
+
+	bool connect	(Worker &worker);
+	void drop		(Worker &worker);
+	// Reconnects dropped workers with an empty shard, the next resample() fills them
+	void reconnect	();
+	bool send_init	(Worker &worker, const unsigned int &particles_numb);
+
+	const Map					&map;
+	std::vector<Worker>			workers;
+
+	unsigned int				particles_numb;		// Target total over the shards
+	bool						publish_estimate;
+	ShardInit					init_msg;
+	ShardStep					step_msg;
+	bool						is_initialized;
+
+	std::mt19937				gen;
+	std::vector<char>			buffer;
+	std::vector<ShardParticle>	exchange;
+	std::vector<unsigned int>	counts;				// Per worker shard size after resampling
+	std::vector<unsigned int>	shares;				// Per worker balanced shard size
+};
+
+/*
+ * Worker side: serves each coordinator connection with its own shard on its own thread.
+ */
+class ShardServer
+{
+public:
+	explicit ShardServer(const Map &map_landmarks) : map(map_landmarks), listen_fd(-1) {}
+	~ShardServer();
+
+	bool listen_tcp	(const unsigned int &port);
+	/**
+	 * run Accepts connections until the listener fails.
+	 */
+	void run		();
+private:
+	void serve		(const int fd) const;
+
+	const Map					&map;
+	int							listen_fd;
+};
+
+#endif /* __DISTRIBUTED_H__ */
@@ -0,0 +1,165 @@
+#include "flight_recorder.h"
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
+
+namespace
+{
+	// Slots start this large so typical frames are copied without allocating
+	const size_t SLOT_RESERVE = 4096;
+
+	uint64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	template<typename Type>
+	void append(std::vector<char> &out, const Type *values, const size_t &n)
+	{
+		const char *bytes = reinterpret_cast<const char*>(values);
+		out.insert(out.end(), bytes, bytes + n * sizeof(Type));
+	}
+	template<typename Type>
+	bool extract(const char *&in, const char *end, std::vector<Type> &values, const size_t &n)
+	{
+		if (size_t(end - in) < n * sizeof(Type))
+			return false;
+
+		values.resize(n);
+		std::memcpy(values.data(), in, n * sizeof(Type));
+		in += n * sizeof(Type);
+		return true;
+	}
+}
+
+FlightRecorder::FlightRecorder(const unsigned int &frames, const double &budget, const std::string &dump_dir, const uint32_t &session_id) :
+	frames_numb(std::max(1u, frames)), budget_us(budget), dir(dump_dir), session(session_id), slots(2 * frames_numb), frame(0), quiet_until(0), start_ns(now_ns())
+{
+	for (unsigned int i = 0; i < slots.size(); ++i)
+		slots[i].payload.reserve(SLOT_RESERVE);
+}
+void FlightRecorder::begin_frame(const CaptureKind &kind, const char *data, const size_t &length, const ParticleFilter &pf)
+{
+	if (frame % frames_numb == 0)
+	{
+		Checkpoint &checkpoint = checkpoints[(frame / frames_numb) % 2];
+		checkpoint.frame = frame;
+		checkpoint.valid = true;
+		pf.save_state(checkpoint.state);
+	}
+
+	Slot &slot = slots[frame % slots.size()];
+	slot.kind  = kind;
+	slot.t_ns  = now_ns() - start_ns;
+	slot.payload.assign(data, data + length);
+}
+void FlightRecorder::end_frame(const double *stage_ns)
+{
+	Slot &slot = slots[frame % slots.size()];
+
+	double frame_ns = 0.0;
+	for (unsigned int i = 0; i < alloc_stats::STAGE_COUNT; ++i)
+	{
+		slot.stage_ns[i] = stage_ns[i];
+		frame_ns		+= stage_ns[i];
+	}
+
+	++frame;
+
+	if (frame_ns * 1e-3 > budget_us && frame >= quiet_until)
+	{
+		dump(frame_ns * 1e-3);
+		quiet_until = frame + frames_numb;
+	}
+}
+void FlightRecorder::dump(const double &frame_us)
+{
+	// The older checkpoint is at most 2K - 1 frames back, so its frames are all still in the ring
+	const unsigned long last  = frame - 1;
+	const Checkpoint   &older = checkpoints[(last / frames_numb + 1) % 2];
+	const Checkpoint   &first = older.valid && older.frame <= last ? older : checkpoints[(last / frames_numb) % 2];
+
+	std::ostringstream path;
+	path << dir << "/slow_" << getpid() << "_" << session << "_" << last << ".cap";
+
+	CaptureWriter writer;
+	if (!writer.open(path.str()))
+	{
+		std::cerr << "Flight recorder: could not write " << path.str() << std::endl;
+		return;
+	}
+
+	CaptureRecord rec;
+	rec.session	 = 1;
+	rec.reserved = 0;
+
+	rec.t_ns   = slots[first.frame % slots.size()].t_ns;
+	rec.kind   = CAPTURE_STATE;
+	encode_filter_state(first.state, scratch);
+	rec.length = scratch.size();
+	writer.record(rec, scratch.data());
+
+	for (unsigned long f = first.frame; f <= last; ++f)
+	{
+		const Slot &slot = slots[f % slots.size()];
+
+		rec.t_ns   = slot.t_ns;
+		rec.kind   = slot.kind;
+		rec.length = slot.payload.size();
+		writer.record(rec, slot.payload.data());
+
+		rec.kind   = CAPTURE_TIMING;
+		rec.length = sizeof(slot.stage_ns);
+		writer.record(rec, reinterpret_cast<const char*>(slot.stage_ns));
+	}
+
+	std::cerr << "Flight recorder: frame " << last << " took " << frame_us << " us (budget " << budget_us << " us), "
+			  << last - first.frame + 1 << " frames written to " << path.str() << std::endl;
+}
+void encode_filter_state(const FilterState &state, std::vector<char> &payload)
+{
+	// The generators go through their portable text form
+	std::ostringstream gen;
+	gen << state.gen << ' ' << state.resamples << ' ' << state.island_gens.size();
+
+	for (unsigned int k = 0; k < state.island_gens.size(); ++k)
+		gen << ' ' << state.island_gens[k];
+	const std::string gen_text = gen.str();
+
+	const uint32_t header[4] = { state.particles_numb, state.initialized ? 1u : 0u, uint32_t(sizeof(scalar_t)), uint32_t(gen_text.size()) };
+
+	payload.clear();
+	append(payload, header,				4);
+	append(payload, gen_text.data(),	gen_text.size());
+	append(payload, state.ids.data(),	  state.particles_numb);
+	append(payload, state.xs.data(),	  state.particles_numb);
+	append(payload, state.ys.data(),	  state.particles_numb);
+	append(payload, state.thetas.data(),  state.particles_numb);
+	append(payload, state.weights.data(), state.particles_numb);
+}
+bool decode_filter_state(const char *payload, const size_t &length, FilterState &state)
+{
+	const char *in	= payload;
+	const char *end = payload + length;
+
+	std::vector<uint32_t> header;
+	std::vector<char>	  gen_text;
+
+	// A checkpoint written by a build with the other scalar policy is rejected
+	if (!extract(in, end, header, 4) || header[2] != sizeof(scalar_t) || !extract(in, end, gen_text, header[3]))
+		return false;
+
+	state.particles_numb = header[0];
+	state.initialized	 = header[1] != 0;
+
+	std::istringstream gen(std::string(gen_text.begin(), gen_text.end()));
+	size_t			   islands_numb = 0;
+	gen >> state.gen >> state.resamples >> islands_numb;
+
+	state.island_gens.resize(gen.fail() ? 0 : std::min<size_t>(islands_numb, state.particles_numb));
+	for (unsigned int k = 0; k < state.island_gens.size(); ++k)
+		gen >> state.island_gens[k];
+
+	return !gen.fail() && extract(in, end, state.ids, state.particles_numb) && extract(in, end, state.xs, state.particles_numb) && extract(in, end, state.ys, state.particles_numb)
+		&& extract(in, end, state.thetas, state.particles_numb) && extract(in, end, state.weights, state.particles_numb) && in == end;
+}
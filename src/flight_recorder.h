@@ -0,0 +1,77 @@
+#ifndef __FLIGHT_RECORDER_H__
+#define __FLIGHT_RECORDER_H__
+
+#include <string>
+#include <vector>
+#include "particle_filter.h"
+#include "alloc_stats.h"
+#include "capture.h"
+
+/*
+ * Per-session flight recorder. Keeps the inputs and stage timings of the last 2K frames
+ * in preallocated slots, plus a filter checkpoint every K frames, and when a frame blows
+ * the latency budget writes the window since the older checkpoint (K to 2K frames) as a
+ * capture. Replaying the dump with pf_replay restores the checkpoint first, so the slow
+ * frame is reproduced with the exact particles and random numbers it originally saw.
+ */
+class FlightRecorder
+{
+public:
+	/**
+	 * FlightRecorder
+	 * @param frames_numb K, frames between checkpoints
+	 * @param budget_us Frame latency budget [us]
+	 * @param dir Directory the dumps are written to
+	 */
+	FlightRecorder(const unsigned int &frames_numb, const double &budget_us, const std::string &dir, const uint32_t &session);
+	/**
+	 * begin_frame Records a frame's input, checkpointing the filter first when due.
+	 */
+	void begin_frame	(const CaptureKind &kind, const char *data, const size_t &length, const ParticleFilter &pf);
+	/**
+	 * end_frame Records the frame's stage timings and dumps the window if it was over budget.
+	 * @param stage_ns Time spent per alloc_stats::Stage [ns]
+	 */
+	void end_frame		(const double *stage_ns);
+private:
+	struct Slot
+	{
+		CaptureKind				kind;
+		uint64_t				t_ns;
+		std::vector<char>		payload;
+		double					stage_ns[alloc_stats::STAGE_COUNT];
+	};
+	struct Checkpoint
+	{
+		Checkpoint() : frame(0), valid(false) {}
+
+		unsigned long			frame;				// First frame recorded after the checkpoint
+		bool					valid;
+		FilterState				state;
+	};
+
+	void dump			(const double &frame_us);
+
+	const unsigned int			frames_numb;
+	const double				budget_us;
+	const std::string			dir;
+	const uint32_t				session;
+
+	std::vector<Slot>			slots;				// Ring of the last 2K frames
+	Checkpoint					checkpoints[2];
+	unsigned long				frame;				// Frames begun so far
+	unsigned long				quiet_until;		// No new dump before this frame, one per window is enough
+	uint64_t					start_ns;
+	std::vector<char>			scratch;
+};
+/**
+ * encode_filter_state Serializes a checkpoint into a CAPTURE_STATE payload.
+ */
+void encode_filter_state(const FilterState &state, std::vector<char> &payload);
+/**
+ * decode_filter_state Parses a CAPTURE_STATE payload.
+ * @output False if the payload is malformed
+ */
+bool decode_filter_state(const char *payload, const size_t &length, FilterState &state);
+
+#endif /* __FLIGHT_RECORDER_H__ */
@@ -4,8 +4,10 @@
 #include <sstream>
 #include <fstream>
 #include <math.h>
+#include <cstdlib>
 #include <vector>
 #include <algorithm>
+#include "scalar.h"
 #include "map.h"
 
 static const double PI = 3.1415926535897932384626433832795;
@@ -33,11 +35,11 @@ struct ground_truth
 struct LandmarkObs 
 {
 	LandmarkObs(){}
-	LandmarkObs(const double& _x, const double& _y, const int &_id) :x(_x), y(_y), id(_id) {}
+	LandmarkObs(const scalar_t& _x, const scalar_t& _y, const int &_id) :id(_id), x(_x), y(_y) {}
 
 	int id;			    // Id of matching landmark in the map.
-	double x;			// Local (vehicle coordinates) x position of landmark observation [m]
-	double y;			// Local (vehicle coordinates) y position of landmark observation [m]
+	scalar_t x;			// Local (vehicle coordinates) x position of landmark observation [m]
+	scalar_t y;			// Local (vehicle coordinates) y position of landmark observation [m]
 };
 /*
  * Computes the Euclidean distance between two 2D points.
@@ -45,11 +47,19 @@ struct LandmarkObs
  * @param (x2,y2) x and y coordinates of second point
  * @output Euclidean distance between two 2D points
  */
-inline double dist(const double &x1, const double &y1, const double &x2,const  double &y2)
+inline scalar_t dist(const scalar_t &x1, const scalar_t &y1, const scalar_t &x2,const  scalar_t &y2)
 {
 	return std::sqrt((x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1));
 }
 
+/*
+ * Squared Euclidean distance, for comparisons where the sqrt is not needed.
+ */
+inline scalar_t dist2(const scalar_t &x1, const scalar_t &y1, const scalar_t &x2, const scalar_t &y2)
+{
+	return (x2 - x1) * (x2 - x1) + (y2 - y1) * (y2 - y1);
+}
+
 inline std::vector<double> getError(const double &gt_x, const double &gt_y, const double &gt_theta, const double &pf_x, const double &pf_y, const double &pf_theta)
 {
 	std::vector<double> error = { std::fabs(pf_x - gt_x) ,std::fabs(pf_y - gt_y) ,std::fmod(std::fabs(pf_theta - gt_theta),2.0* PI) };
@@ -57,7 +67,7 @@ inline std::vector<double> getError(const double &gt_x, const double &gt_y, cons
 		error[2] = 2.0 * PI - error[2];
 	return error;
 }
-/* Reads map data from a file.
+/* Reads map data from a file. Landmarks are stored relative to Map::origin_x/origin_y.
  * @param filename Name of file containing map data.
  * @output True if opening and reading file was successful
  */
@@ -72,23 +82,29 @@ inline bool read_map_data(const std::string &filename, Map& map)
 	// Declare single line of map file:
 	std::string line_map;
 
+	// Global coordinates are kept in double until the local origin is known
+	std::vector<double> global_x, global_y;
+	std::vector<unsigned int> ids;
+
 	// Run over each single line:
 	while(getline(in_file_map, line_map))
 	{
 		std::istringstream iss_map(line_map);
 
-		// Declare single_landmark:
-		Map::single_landmark_s single_landmark_temp;
-		
+		double x = 0.0, y = 0.0;
+		unsigned int id = 0;
+
 		// Set values
-		iss_map >> single_landmark_temp.x_f;
-		iss_map >> single_landmark_temp.y_f;
-		iss_map >> single_landmark_temp.id_i;
+		iss_map >> x;
+		iss_map >> y;
+		iss_map >> id;
 
-		
-		// Add to landmark list of map:
-		map.landmark_list.push_back(single_landmark_temp);
+		global_x.push_back(x);
+		global_y.push_back(y);
+		ids.push_back(id);
 	}
+
+	map.set_landmarks(global_x.data(), global_y.data(), ids.data(), ids.size());
 	return true;
 }
 
@@ -207,6 +223,23 @@ struct String2Float
 		return std::stod(str, std::string::size_type());
 	}
 };
+struct String2Floats
+{
+	// Parses a whitespace separated list of numbers into out, reusing its capacity
+	void operator()(const std::string &str, std::vector<float> &out) const
+	{
+		out.clear();
+
+		const char *it = str.c_str();
+		char *end = nullptr;
+
+		for (float val = std::strtof(it, &end); end != it; val = std::strtof(it, &end))
+		{
+			out.push_back(val);
+			it = end;
+		}
+	}
+};
 struct String2Array
 {
 	std::vector<double> operator()(const std::string&str)
@@ -0,0 +1,86 @@
+#include "hilbert.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const unsigned int RADIX		= 256;
+	const unsigned int SORT_GRAIN	= 8192;		// Smallest chunk worth its own histogram
+}
+
+void hilbert::sort(uint32_t *keys, unsigned int *order, uint32_t *keys_tmp, unsigned int *order_tmp, const unsigned int &n,
+				   const unsigned int &bits, ThreadPool *pool, std::vector<unsigned int> &histograms)
+{
+	for (unsigned int i = 0; i < n; ++i)
+		order[i] = i;
+
+	const unsigned int chunks_max = pool ? pool->size() : 1;
+	histograms.resize(chunks_max * RADIX);
+
+	uint32_t	 *src_keys	= keys,		*dst_keys  = keys_tmp;
+	unsigned int *src_order = order,	*dst_order = order_tmp;
+
+	for (unsigned int shift = 0; shift < bits; shift += 8)
+	{
+		auto count = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+		{
+			unsigned int *hist = histograms.data() + chunk * RADIX;
+			std::memset(hist, 0, RADIX * sizeof(unsigned int));
+
+			for (unsigned int i = begin; i < end; ++i)
+				++hist[(src_keys[i] >> shift) & (RADIX - 1)];
+		};
+		const unsigned int chunks = pool ? pool->parallel_for(n, SORT_GRAIN, count) : (count(0, 0, n), 1);
+
+		// Digit-major exclusive prefix over the chunks keeps equal digits in chunk order, i.e. stable
+		unsigned int offset = 0;
+		bool		 single = false;
+
+		for (unsigned int d = 0; d < RADIX; ++d)
+		{
+			unsigned int digit_total = 0;
+			for (unsigned int c = 0; c < chunks; ++c)
+			{
+				unsigned int &h = histograms[c * RADIX + d];
+				const unsigned int count_d = h;
+
+				h			 = offset;
+				offset		+= count_d;
+				digit_total += count_d;
+			}
+			single = single || digit_total == n;
+		}
+
+		// Every key has the same digit, this pass would not move anything
+		if (single)
+			continue;
+
+		auto scatter = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+		{
+			unsigned int *hist = histograms.data() + chunk * RADIX;
+
+			for (unsigned int i = begin; i < end; ++i)
+			{
+				const unsigned int slot = hist[(src_keys[i] >> shift) & (RADIX - 1)]++;
+
+				dst_keys[slot]	= src_keys[i];
+				dst_order[slot] = src_order[i];
+			}
+		};
+		if (pool)
+			pool->parallel_for(n, SORT_GRAIN, scatter);
+		else
+			scatter(0, 0, n);
+
+		std::swap(src_keys, dst_keys);
+		std::swap(src_order, dst_order);
+	}
+
+	// An odd number of executed passes leaves the result in the scratch arrays
+	if (src_keys != keys)
+	{
+		std::memcpy(keys,  src_keys,  n * sizeof(uint32_t));
+		std::memcpy(order, src_order, n * sizeof(unsigned int));
+	}
+}
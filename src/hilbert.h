@@ -0,0 +1,106 @@
+#ifndef __HILBERT_H__
+#define __HILBERT_H__
+
+#include <stdint.h>
+#include <vector>
+#include "thread_pool.h"
+
+/*
+ * Hilbert curve order of planar points. Points close on the curve are close in the plane,
+ * so data stored in curve order is visited coherently by spatial queries.
+ */
+namespace hilbert
+{
+	// Spreads the 16 low bits of x over the even bits of the result
+	inline uint32_t spread(uint32_t x)
+	{
+		x = (x | (x << 8)) & 0x00FF00FF;
+		x = (x | (x << 4)) & 0x0F0F0F0F;
+		x = (x | (x << 2)) & 0x33333333;
+		x = (x | (x << 1)) & 0x55555555;
+		return x;
+	}
+	/**
+	 * key Position of cell (x, y) of the 2^16 x 2^16 grid along the Hilbert curve. The
+	 *   orientation of every level depends on all coarser levels; instead of walking them with
+	 *   a branch per level (which mispredicts on scattered points), the orientations are
+	 *   composed as a parallel prefix scan over the bits, 16 levels in 4 rounds.
+	 */
+	inline uint32_t key(const uint32_t &x, const uint32_t &y)
+	{
+		uint32_t A, B, C, D;
+
+		// First round, the per-level transforms from the bits of x and y
+		{
+			const uint32_t a = x ^ y;
+			const uint32_t b = 0xFFFF ^ a;
+			const uint32_t c = 0xFFFF ^ (x | y);
+			const uint32_t d = x & (y ^ 0xFFFF);
+
+			A = a | (b >> 1);
+			B = (a >> 1) ^ a;
+			C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+			D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+		}
+		// Each round composes the transforms of the next 2, 4 coarser levels
+		for (unsigned int shift = 2; shift <= 4; shift <<= 1)
+		{
+			const uint32_t a = A, b = B, c = C, d = D;
+
+			A  = (a & (a >> shift)) ^ (b & (b >> shift));
+			B  = (a & (b >> shift)) ^ (b & ((a ^ b) >> shift));
+			C ^= (a & (c >> shift)) ^ (b & (d >> shift));
+			D ^= (b & (c >> shift)) ^ ((a ^ b) & (d >> shift));
+		}
+		// Last round only needs the transform's effect, not its composition
+		{
+			const uint32_t a = A, b = B, c = C, d = D;
+
+			C ^= (a & (c >> 8)) ^ (b & (d >> 8));
+			D ^= (b & (c >> 8)) ^ ((a ^ b) & (d >> 8));
+		}
+
+		const uint32_t a  = C ^ (C >> 1);
+		const uint32_t b  = D ^ (D >> 1);
+		const uint32_t i0 = x ^ y;
+		const uint32_t i1 = b | (0xFFFF ^ (i0 | a));
+
+		return (spread(i1) << 1) | spread(i0);
+	}
+
+	/*
+	 * Maps points of a bounding box onto the key grid.
+	 */
+	struct Grid
+	{
+		Grid(const double &min_x, const double &min_y, const double &max_x, const double &max_y) : min_x(min_x), min_y(min_y),
+			scale_x(max_x > min_x ? 65535.0 / (max_x - min_x) : 0.0), scale_y(max_y > min_y ? 65535.0 / (max_y - min_y) : 0.0) {}
+
+		uint32_t key(const double &x, const double &y) const
+		{
+			const double gx = (x - min_x) * scale_x;
+			const double gy = (y - min_y) * scale_y;
+
+			return hilbert::key(gx > 0.0 ? (gx < 65535.0 ? uint32_t(gx) : 65535u) : 0u, gy > 0.0 ? (gy < 65535.0 ? uint32_t(gy) : 65535u) : 0u);
+		}
+
+		double					min_x;
+		double					min_y;
+		double					scale_x;
+		double					scale_y;
+	};
+
+	/**
+	 * sort Stable LSD radix sort of keys[0, n), 8 bits per pass. order receives the original
+	 *   position of every sorted key; keys ends up sorted. Each pass histograms the chunks of
+	 *   the pool in parallel and scatters them in parallel, so the result does not depend on
+	 *   the thread count. Passes whose digit is the same for every key are skipped.
+	 * @param bits Keys are below 2^bits, key >> (32 - bits) sorts on a coarser curve in fewer passes
+	 * @param keys_tmp, order_tmp Scratch arrays of n elements
+	 * @param histograms Scratch, resized as needed
+	 */
+	void sort(uint32_t *keys, unsigned int *order, uint32_t *keys_tmp, unsigned int *order_tmp, const unsigned int &n,
+			  const unsigned int &bits, ThreadPool *pool, std::vector<unsigned int> &histograms);
+}
+
+#endif /* __HILBERT_H__ */
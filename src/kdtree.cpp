@@ -0,0 +1,60 @@
+#include "kdtree.h"
+
+#include <algorithm>
+
+void KdTree::build(const std::vector<Map::single_landmark_s> &landmarks)
+{
+	nodes.resize(landmarks.size());
+
+	for (unsigned int i = 0; i < landmarks.size(); ++i)
+	{
+		nodes[i].x		= landmarks[i].x_f;
+		nodes[i].y		= landmarks[i].y_f;
+		nodes[i].index	= i;
+	}
+	build(0, nodes.size(), 0);
+}
+void KdTree::build(unsigned int lo, unsigned int hi, unsigned int depth)
+{
+	if (hi - lo <= LEAF_SIZE)
+		return;
+
+	const unsigned int mid = lo + (hi - lo) / 2;
+
+	if (depth % 2 == 0)
+		std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi, [](const Node &a, const Node &b) { return a.x < b.x; });
+	else
+		std::nth_element(nodes.begin() + lo, nodes.begin() + mid, nodes.begin() + hi, [](const Node &a, const Node &b) { return a.y < b.y; });
+
+	build(lo,	   mid, depth + 1);
+	build(mid + 1, hi,	depth + 1);
+}
+void KdTree::radius(const scalar_t &x, const scalar_t &y, const scalar_t &r2, std::vector<unsigned int> &out) const
+{
+	radius(0, nodes.size(), 0, x, y, r2, out);
+}
+void KdTree::radius(unsigned int lo, unsigned int hi, unsigned int depth, const scalar_t &x, const scalar_t &y, const scalar_t &r2, std::vector<unsigned int> &out) const
+{
+	if (hi - lo <= LEAF_SIZE)
+	{
+		for (unsigned int i = lo; i < hi; ++i)
+		{
+			if ((nodes[i].x - x) * (nodes[i].x - x) + (nodes[i].y - y) * (nodes[i].y - y) < r2)
+				out.push_back(nodes[i].index);
+		}
+		return;
+	}
+
+	const unsigned int mid = lo + (hi - lo) / 2;
+	const Node		   &n  = nodes[mid];
+
+	const scalar_t diff = depth % 2 == 0 ? x - n.x : y - n.y;
+
+	if ((n.x - x) * (n.x - x) + (n.y - y) * (n.y - y) < r2)
+		out.push_back(n.index);
+
+	if (diff < 0 || diff * diff < r2)
+		radius(lo, mid, depth + 1, x, y, r2, out);
+	if (diff >= 0 || diff * diff < r2)
+		radius(mid + 1, hi, depth + 1, x, y, r2, out);
+}
@@ -0,0 +1,38 @@
+#ifndef __KDTREE_H__
+#define __KDTREE_H__
+
+#include <vector>
+#include "map.h"
+
+/*
+ * Static 2D k-d tree over the map landmarks. The tree is implicit: nodes are stored
+ * in one array, every range [lo, hi) is split at its median along x or y alternately,
+ * and small ranges are scanned linearly. All distances are squared.
+ */
+class KdTree
+{
+public:
+	struct Node
+	{
+		scalar_t		x;
+		scalar_t		y;
+		unsigned int	index;	// Index into Map::landmark_list
+	};
+
+	void build(const std::vector<Map::single_landmark_s> &landmarks);
+	/**
+	 * radius Appends the indices of all landmarks with squared distance below r2 to out.
+	 */
+	void radius(const scalar_t &x, const scalar_t &y, const scalar_t &r2, std::vector<unsigned int> &out) const;
+
+	unsigned int size() const { return nodes.size(); }
+private:
+	void build		(unsigned int lo, unsigned int hi, unsigned int depth);
+	void radius		(unsigned int lo, unsigned int hi, unsigned int depth, const scalar_t &x, const scalar_t &y, const scalar_t &r2, std::vector<unsigned int> &out) const;
+
+	static const unsigned int LEAF_SIZE = 8;
+
+	std::vector<Node>	nodes;
+};
+
+#endif /* __KDTREE_H__ */
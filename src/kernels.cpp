@@ -0,0 +1,65 @@
+#include "kernels.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+CpuLevel host_cpu_level()
+{
+#ifdef PF_X86_KERNELS
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f"))
+		return CPU_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return CPU_AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return CPU_SSE42;
+#endif
+	return CPU_GENERIC;
+}
+const char* cpu_level_name(const CpuLevel &level)
+{
+	static const char* names[CPU_LEVEL_COUNT] = { "generic", "sse42", "avx2", "avx512" };
+	return names[level];
+}
+CpuLevel detect_cpu_level()
+{
+	const CpuLevel host	 = host_cpu_level();
+	const char	   *env	 = std::getenv("PF_CPU_LEVEL");
+
+	if (!env || !*env)
+		return host;
+
+	for (int i = 0; i < CPU_LEVEL_COUNT; ++i)
+	{
+		if (std::strcmp(env, cpu_level_name(static_cast<CpuLevel>(i))) != 0)
+			continue;
+
+		if (i > host)
+		{
+			std::cerr << "PF_CPU_LEVEL=" << env << " is not supported by this host, using " << cpu_level_name(host) << std::endl;
+			return host;
+		}
+		return static_cast<CpuLevel>(i);
+	}
+
+	std::cerr << "Unknown PF_CPU_LEVEL=" << env << ", using " << cpu_level_name(host) << std::endl;
+	return host;
+}
+const Kernels& get_kernels(const CpuLevel &level)
+{
+	switch (level)
+	{
+#ifdef PF_X86_KERNELS
+	case CPU_AVX512:
+		return avx512_kernels;
+	case CPU_AVX2:
+		return avx2_kernels;
+	case CPU_SSE42:
+		return sse42_kernels;
+#endif
+	default:
+		return generic_kernels;
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include "scalar.h"
+
+/*
+ * Numeric kernels of the filter working on structure-of-arrays particle data.
+ * The same source (kernels_impl.h) is compiled once per instruction set and the
+ * best table supported by the host is selected at startup.
+ */
+struct Kernels
+{
+	const char* name;
+	/**
+	 * predict Moves particles [0,n) by the bicycle motion model and adds pre-drawn noise.
+	 */
+	void   (*predict)	(unsigned int n, scalar_t *x, scalar_t *y, scalar_t *theta, const scalar_t *noise_x, const scalar_t *noise_y, const scalar_t *noise_theta,
+						 scalar_t velocity, scalar_t yaw_rate, scalar_t delta_t);
+	/**
+	 * predict_runs predict() of particles stored once per run of copies: run r moves
+	 *   unique_[r] into [run_end[r - 1], run_end[r]) of x, y, theta (run_end[-1] = 0),
+	 *   every copy with its own noise. A null run_end means runs of one particle, which may
+	 *   then be moved in place (unique_ == x, y, theta).
+	 */
+	void   (*predict_runs)(unsigned int runs, const unsigned int *run_end, const scalar_t *unique_x, const scalar_t *unique_y, const scalar_t *unique_theta,
+						 scalar_t *x, scalar_t *y, scalar_t *theta, const scalar_t *noise_x, const scalar_t *noise_y, const scalar_t *noise_theta,
+						 scalar_t velocity, scalar_t yaw_rate, scalar_t delta_t);
+	/**
+	 * transform Transforms observations from vehicle coordinates into the map frame of one particle.
+	 */
+	void   (*transform)	(unsigned int n_obs, const scalar_t *obs_x, const scalar_t *obs_y, scalar_t x, scalar_t y, scalar_t theta, scalar_t *trans_x, scalar_t *trans_y);
+	/**
+	 * exponent For every landmark finds the nearest transformed observation and returns the sum
+	 *   of their Gaussian exponents dx^2/(2 sx^2) + dy^2/(2 sy^2).
+	 * @param min_d2, expo Scratch arrays of n_land elements
+	 */
+	double (*exponent)	(unsigned int n_land, const scalar_t *land_x, const scalar_t *land_y, unsigned int n_obs, const scalar_t *trans_x, const scalar_t *trans_y,
+						 scalar_t inv_2sx2, scalar_t inv_2sy2, scalar_t *min_d2, scalar_t *expo);
+	/**
+	 * systematic Selects n particles with pointers start + i * step over the cumulative weights.
+	 */
+	void   (*systematic)(unsigned int n, const double *weights, double start, double step, unsigned int *indices);
+	/**
+	 * gather dst[i] = src[indices[i]] for i in [0,n).
+	 */
+	void   (*gather)	(unsigned int n, const unsigned int *indices, const scalar_t *src, scalar_t *dst);
+};
+
+enum CpuLevel
+{
+	CPU_GENERIC = 0,
+	CPU_SSE42,
+	CPU_AVX2,
+	CPU_AVX512,
+	CPU_LEVEL_COUNT
+};
+
+/**
+ * detect_cpu_level Returns the best kernel level supported by the host. The PF_CPU_LEVEL
+ *   environment variable (generic, sse42, avx2, avx512) forces a lower level for testing.
+ */
+CpuLevel		detect_cpu_level();
+/**
+ * host_cpu_level Returns the best kernel level supported by the host, ignoring PF_CPU_LEVEL.
+ */
+CpuLevel		host_cpu_level	();
+const char*		cpu_level_name	(const CpuLevel &level);
+const Kernels&	get_kernels		(const CpuLevel &level);
+
+extern const Kernels generic_kernels;
+#ifdef PF_X86_KERNELS
+extern const Kernels sse42_kernels;
+extern const Kernels avx2_kernels;
+extern const Kernels avx512_kernels;
+#endif
+
+#endif /* __KERNELS_H__ */
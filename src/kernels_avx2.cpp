@@ -0,0 +1,7 @@
+#ifdef PF_X86_KERNELS
+#define KERNEL_NAMESPACE	avx2_impl
+#define KERNEL_TABLE		avx2_kernels
+#define KERNEL_NAME			"avx2"
+
+#include "kernels_impl.h"
+#endif
@@ -0,0 +1,7 @@
+#ifdef PF_X86_KERNELS
+#define KERNEL_NAMESPACE	avx512_impl
+#define KERNEL_TABLE		avx512_kernels
+#define KERNEL_NAME			"avx512"
+
+#include "kernels_impl.h"
+#endif
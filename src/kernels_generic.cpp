@@ -0,0 +1,5 @@
+#define KERNEL_NAMESPACE	generic_impl
+#define KERNEL_TABLE		generic_kernels
+#define KERNEL_NAME			"generic"
+
+#include "kernels_impl.h"
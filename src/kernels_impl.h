@@ -0,0 +1,163 @@
+/*
+ * Kernel bodies, included once per instruction set by kernels_<level>.cpp with
+ * KERNEL_NAMESPACE and KERNEL_TABLE defined. No include guard on purpose.
+ * Only raw loops over pointers live here, so nothing compiled with wider
+ * instructions can leak into the generic code through shared inline functions.
+ */
+#include <cmath>
+#include "kernels.h"
+
+namespace KERNEL_NAMESPACE
+{
+	static void predict(unsigned int n, scalar_t *x, scalar_t *y, scalar_t *theta, const scalar_t *noise_x, const scalar_t *noise_y, const scalar_t *noise_theta,
+						scalar_t velocity, scalar_t yaw_rate, scalar_t delta_t)
+	{
+		const scalar_t d_theta = yaw_rate * delta_t;
+
+		if (std::fabs(yaw_rate) > scalar_t(0.001))
+		{
+			// sin(t + a) - sin(t) and cos(t) - cos(t + a) expanded, so only sin(t) and cos(t) are evaluated per particle
+			const scalar_t k	 = velocity / yaw_rate;
+			const scalar_t sin_a = std::sin(d_theta);
+			const scalar_t cos_a = std::cos(d_theta) - scalar_t(1);
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				const scalar_t s = std::sin(theta[i]);
+				const scalar_t c = std::cos(theta[i]);
+
+				x[i]	 += k * (s * cos_a + c * sin_a) + noise_x[i];
+				y[i]	 += k * (s * sin_a - c * cos_a) + noise_y[i];
+				theta[i] += d_theta + noise_theta[i];
+			}
+		}
+		else
+		{
+			const scalar_t d = velocity * delta_t;
+
+			for (unsigned int i = 0; i < n; ++i)
+			{
+				x[i]	 += d * std::cos(theta[i]) + noise_x[i];
+				y[i]	 += d * std::sin(theta[i]) + noise_y[i];
+				theta[i] += d_theta + noise_theta[i];
+			}
+		}
+	}
+	static void predict_runs(unsigned int runs, const unsigned int *run_end, const scalar_t *unique_x, const scalar_t *unique_y, const scalar_t *unique_theta,
+							 scalar_t *x, scalar_t *y, scalar_t *theta, const scalar_t *noise_x, const scalar_t *noise_y, const scalar_t *noise_theta,
+							 scalar_t velocity, scalar_t yaw_rate, scalar_t delta_t)
+	{
+		const scalar_t d_theta = yaw_rate * delta_t;
+		const bool	   turning = std::fabs(yaw_rate) > scalar_t(0.001);
+		const scalar_t k	   = turning ? velocity / yaw_rate : velocity * delta_t;
+		const scalar_t sin_a   = std::sin(d_theta);
+		const scalar_t cos_a   = std::cos(d_theta) - scalar_t(1);
+
+		// Same expressions as predict(), with sin and cos evaluated once per run; the copies of a run
+		// only differ by their noise, one vector pass over it. Reading unique_[r] before writing
+		// copy r keeps unit runs correct in place
+		unsigned int i = 0;
+		for (unsigned int r = 0; r < runs; ++r)
+		{
+			const unsigned int end = run_end ? run_end[r] : r + 1;
+			const scalar_t	   ux = unique_x[r], uy = unique_y[r], ut = unique_theta[r];
+			const scalar_t	   s = std::sin(ut);
+			const scalar_t	   c = std::cos(ut);
+
+			if (turning)
+			{
+				for (; i < end; ++i)
+				{
+					x[i]	 = ux + (k * (s * cos_a + c * sin_a) + noise_x[i]);
+					y[i]	 = uy + (k * (s * sin_a - c * cos_a) + noise_y[i]);
+					theta[i] = ut + (d_theta + noise_theta[i]);
+				}
+			}
+			else
+			{
+				for (; i < end; ++i)
+				{
+					x[i]	 = ux + (k * c + noise_x[i]);
+					y[i]	 = uy + (k * s + noise_y[i]);
+					theta[i] = ut + (d_theta + noise_theta[i]);
+				}
+			}
+		}
+	}
+	static void transform(unsigned int n_obs, const scalar_t *obs_x, const scalar_t *obs_y, scalar_t x, scalar_t y, scalar_t theta, scalar_t *trans_x, scalar_t *trans_y)
+	{
+		const scalar_t c = std::cos(theta);
+		const scalar_t s = std::sin(theta);
+
+		for (unsigned int j = 0; j < n_obs; ++j)
+		{
+			trans_x[j] = obs_x[j] * c - obs_y[j] * s + x;
+			trans_y[j] = obs_x[j] * s + obs_y[j] * c + y;
+		}
+	}
+	static double exponent(unsigned int n_land, const scalar_t *land_x, const scalar_t *land_y, unsigned int n_obs, const scalar_t *trans_x, const scalar_t *trans_y,
+						   scalar_t inv_2sx2, scalar_t inv_2sy2, scalar_t *min_d2, scalar_t *expo)
+	{
+		for (unsigned int j = 0; j < n_land; ++j)
+		{
+			min_d2[j] = HUGE_VALF;
+			expo[j]	  = 0;
+		}
+
+		// Landmarks are the vector lanes, observations the (short) outer loop
+		for (unsigned int k = 0; k < n_obs; ++k)
+		{
+			const scalar_t ox = trans_x[k];
+			const scalar_t oy = trans_y[k];
+
+			for (unsigned int j = 0; j < n_land; ++j)
+			{
+				const scalar_t dx = land_x[j] - ox;
+				const scalar_t dy = land_y[j] - oy;
+				const scalar_t d2 = dx * dx + dy * dy;
+				const scalar_t e  = dx * dx * inv_2sx2 + dy * dy * inv_2sy2;
+				const bool closer = d2 < min_d2[j];
+
+				min_d2[j] = closer ? d2 : min_d2[j];
+				expo[j]	  = closer ? e	: expo[j];
+			}
+		}
+
+		double sum = 0.0;
+		for (unsigned int j = 0; j < n_land; ++j)
+			sum += expo[j];
+
+		return sum;
+	}
+	static void systematic(unsigned int n, const double *weights, double start, double step, unsigned int *indices)
+	{
+		double		 pointer	= start;
+		double		 cumulative = weights[0];
+		unsigned int index		= 0;
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			while (pointer > cumulative && index < n - 1)
+				cumulative += weights[++index];
+
+			indices[i] = index;
+			pointer	  += step;
+		}
+	}
+	static void gather(unsigned int n, const unsigned int *indices, const scalar_t *src, scalar_t *dst)
+	{
+		for (unsigned int i = 0; i < n; ++i)
+			dst[i] = src[indices[i]];
+	}
+}
+
+const Kernels KERNEL_TABLE =
+{
+	KERNEL_NAME,
+	&KERNEL_NAMESPACE::predict,
+	&KERNEL_NAMESPACE::predict_runs,
+	&KERNEL_NAMESPACE::transform,
+	&KERNEL_NAMESPACE::exponent,
+	&KERNEL_NAMESPACE::systematic,
+	&KERNEL_NAMESPACE::gather
+};
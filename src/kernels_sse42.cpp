@@ -0,0 +1,7 @@
+#ifdef PF_X86_KERNELS
+#define KERNEL_NAMESPACE	sse42_impl
+#define KERNEL_TABLE		sse42_kernels
+#define KERNEL_NAME			"sse42"
+
+#include "kernels_impl.h"
+#endif
@@ -10,6 +10,9 @@
 #include <sstream>
 #include <string>
 #include <iterator>
+#include <cstdio>
+#include <limits>
+#include <memory>
 
 
 
@@ -0,0 +1,273 @@
+#include <uWS/uWS.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include "helper_functions.h"
+
+/*
+ * Load generator standing in for many simulators. Opens N websocket connections to
+ * Master, each sending telemetry at a fixed rate, and reports round-trip latency
+ * percentiles and sustained throughput. Telemetry is either synthetic (a vehicle
+ * circling over the map) or recorded, from a directory holding control_data.txt,
+ * gt_data.txt and observation/observations_NNNNNN.txt. Every connection replays the
+ * same frames from its own start time, wrapping around at the end.
+ * Usage: load_generator [clients] [rate_hz] [seconds] [url] [map_file|data_dir]
+ * To find how many vehicles one box serves at 10 Hz, double clients until it reports OVERLOADED.
+ */
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Client
+	{
+		Client() : frame(0), sent(0), received(0), timer(nullptr) {}
+
+		unsigned int				frame;			// Next frame to send
+		unsigned long				sent;
+		unsigned long				received;
+		std::deque<Clock::time_point> in_flight;	// Send times of unanswered frames, replies arrive in order
+		std::unique_ptr<uWS::WebSocket<uWS::CLIENT>> ws;
+		uS::Timer					*timer;
+	};
+
+	struct LoadState
+	{
+		LoadState() : deadline_reached(false), failed(0) {}
+
+		std::vector<std::string>	messages;		// Pre-rendered socket.io telemetry messages
+		std::vector<Client>			clients;
+		std::vector<double>			latency_us;
+		bool						deadline_reached;
+		unsigned int				failed;
+	};
+
+	LoadState state;
+
+	std::string join(const std::vector<double> &values)
+	{
+		std::string s;
+		char		buff[32];
+
+		for (unsigned int i = 0; i < values.size(); ++i)
+		{
+			snprintf(buff, sizeof(buff), i ? " %.4f" : "%.4f", values[i]);
+			s += buff;
+		}
+		return s;
+	}
+	std::string render(const ground_truth &gps, const control_s &control, const std::vector<double> &obs_x, const std::vector<double> &obs_y)
+	{
+		char buff[256];
+		snprintf(buff, sizeof(buff), "42[\"telemetry\",{\"sense_x\":\"%.4f\",\"sense_y\":\"%.4f\",\"sense_theta\":\"%.4f\",\"previous_velocity\":\"%.4f\",\"previous_yawrate\":\"%.4f\",",
+				 gps.x, gps.y, gps.theta, control.velocity, control.yawrate);
+
+		return buff + ("\"sense_observations_x\":\"" + join(obs_x) + "\",\"sense_observations_y\":\"" + join(obs_y) + "\"}]");
+	}
+	// Vehicle circling the centre of the map, observing every landmark within sensor range
+	void synthesize(const Map &map, const unsigned int &frames_numb, std::vector<std::string> &messages)
+	{
+		const double sensor_range = 50.0, delta_t = 0.1, radius = 20.0;
+		const control_s control	  = { 10.0, 10.0 / radius };
+
+		std::mt19937					 gen(11);
+		std::normal_distribution<double> noise(0.0, 0.3);
+		std::vector<double>				 obs_x, obs_y;
+
+		ground_truth gt = { map.origin_x, map.origin_y - radius, 0.0 };
+
+		for (unsigned int f = 0; f < frames_numb; ++f)
+		{
+			if (f)
+			{
+				gt.x	 += control.velocity / control.yawrate * (std::sin(gt.theta + control.yawrate * delta_t) - std::sin(gt.theta));
+				gt.y	 += control.velocity / control.yawrate * (std::cos(gt.theta) - std::cos(gt.theta + control.yawrate * delta_t));
+				gt.theta  = std::fmod(gt.theta + control.yawrate * delta_t, 2.0 * PI);
+			}
+
+			obs_x.clear();
+			obs_y.clear();
+			for (unsigned int i = 0; i < map.landmark_list.size(); ++i)
+			{
+				const double dx = map.to_global_x(map.landmark_list[i].x_f) - gt.x;
+				const double dy = map.to_global_y(map.landmark_list[i].y_f) - gt.y;
+
+				if (dx * dx + dy * dy > sensor_range * sensor_range)
+					continue;
+
+				obs_x.push_back( dx * std::cos(gt.theta) + dy * std::sin(gt.theta) + noise(gen));
+				obs_y.push_back(-dx * std::sin(gt.theta) + dy * std::cos(gt.theta) + noise(gen));
+			}
+
+			const ground_truth gps = { gt.x + noise(gen), gt.y + noise(gen), gt.theta };
+			messages.push_back(render(gps, control, obs_x, obs_y));
+		}
+	}
+	// Frames of a recorded run, the control of frame i is the one applied since frame i - 1
+	bool load_recorded(const std::string &dir, std::vector<std::string> &messages)
+	{
+		std::vector<control_s>		control;
+		std::vector<ground_truth>	gt;
+
+		if (!read_control_data(dir + "/control_data.txt", control) || !read_gt_data(dir + "/gt_data.txt", gt))
+			return false;
+
+		std::mt19937					 gen(11);
+		std::normal_distribution<double> noise(0.0, 0.3);
+		std::vector<LandmarkObs>		 observations;
+		std::vector<double>				 obs_x, obs_y;
+
+		for (unsigned int f = 0; f < gt.size() && f < control.size(); ++f)
+		{
+			char path[64];
+			snprintf(path, sizeof(path), "/observation/observations_%06u.txt", f + 1);
+
+			observations.clear();
+			if (!read_landmark_data(dir + path, observations))
+				break;
+
+			obs_x.clear();
+			obs_y.clear();
+			for (unsigned int i = 0; i < observations.size(); ++i)
+			{
+				obs_x.push_back(observations[i].x);
+				obs_y.push_back(observations[i].y);
+			}
+
+			const ground_truth gps = { gt[f].x + noise(gen), gt[f].y + noise(gen), gt[f].theta };
+			messages.push_back(render(gps, control[f ? f - 1 : 0], obs_x, obs_y));
+		}
+		return !messages.empty();
+	}
+	void send_frame(uS::Timer *timer)
+	{
+		Client &client = *static_cast<Client*>(timer->getData());
+
+		if (!client.ws || state.deadline_reached)
+			return;
+
+		const std::string &msg = state.messages[client.frame];
+		client.frame = (client.frame + 1) % state.messages.size();
+
+		client.in_flight.push_back(Clock::now());
+		client.ws->send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+		++client.sent;
+	}
+	double percentile(const std::vector<double> &sorted, const double &p)
+	{
+		return sorted.empty() ? 0.0 : sorted[std::min<size_t>(sorted.size() - 1, size_t(p * sorted.size()))];
+	}
+	void report(const double &rate, const double &seconds)
+	{
+		unsigned long sent = 0, received = 0;
+		for (unsigned int i = 0; i < state.clients.size(); ++i)
+		{
+			sent	 += state.clients[i].sent;
+			received += state.clients[i].received;
+		}
+
+		std::vector<double> &latency = state.latency_us;
+		std::sort(latency.begin(), latency.end());
+
+		const double offered   = rate * state.clients.size();
+		const double sustained = received / seconds;
+		const double p99_ms	   = percentile(latency, 0.99) * 1e-3;
+		const bool	 keeps_up  = state.failed == 0 && sustained >= 0.95 * offered && p99_ms < 1000.0 / rate;
+
+		std::cout << std::fixed << std::setprecision(1);
+		std::cout << "clients         = " << state.clients.size() << " (" << state.failed << " failed to connect)" << std::endl;
+		std::cout << "frames          = " << sent << " sent, " << received << " answered" << std::endl;
+		std::cout << "throughput      = " << sustained << " frames/s (offered " << offered << ")" << std::endl;
+		std::cout << "round trip [us] = p50 " << percentile(latency, 0.5) << "  p90 " << percentile(latency, 0.9)
+				  << "  p99 " << percentile(latency, 0.99) << "  max " << (latency.empty() ? 0.0 : latency.back()) << std::endl;
+		std::cout << (keeps_up ? "SUSTAINED" : "OVERLOADED") << " at " << rate << " Hz per vehicle" << std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned int	clients_numb = argc > 1 ? std::atoi(argv[1]) : 10;
+	const double		rate		 = argc > 2 ? std::atof(argv[2]) : 10.0;
+	const double		seconds		 = argc > 3 ? std::atof(argv[3]) : 10.0;
+	const std::string	url			 = argc > 4 ? argv[4] : "ws://127.0.0.1:4567";
+	const std::string	source		 = argc > 5 ? argv[5] : "../data/map_data.txt";
+
+	Map map;
+	if (!load_recorded(source, state.messages))
+	{
+		if (!read_map_data(source, map))
+		{
+			std::cerr << "Error: " << source << " is neither a map file nor a recorded data directory" << std::endl;
+			return 1;
+		}
+		synthesize(map, std::max(1u, unsigned(rate * seconds)), state.messages);
+	}
+
+	const int period_ms = std::max(1, int(1000.0 / rate));
+
+	uWS::Hub h;
+	state.clients.resize(clients_numb);
+	state.latency_us.reserve(size_t(clients_numb * rate * seconds) + clients_numb);
+
+	h.onConnection([&h, period_ms](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req)
+	{
+		Client &client = *static_cast<Client*>(ws.getData());
+		client.ws.reset(new uWS::WebSocket<uWS::CLIENT>(ws));
+
+		// Stagger the clients over one period so the server sees a steady rate, not bursts
+		const unsigned int index = &client - &state.clients[0];
+		client.timer = new uS::Timer(h.getLoop());
+		client.timer->setData(&client);
+		client.timer->start(send_frame, 1 + index * period_ms / state.clients.size(), period_ms);
+	});
+	h.onMessage([](uWS::WebSocket<uWS::CLIENT> ws, char *message, size_t length, uWS::OpCode opCode)
+	{
+		Client &client = *static_cast<Client*>(ws.getData());
+
+		if (client.in_flight.empty() || state.deadline_reached)
+			return;
+
+		state.latency_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - client.in_flight.front()).count());
+		client.in_flight.pop_front();
+		++client.received;
+	});
+	h.onError([](void *user)
+	{
+		++state.failed;
+	});
+
+	for (unsigned int i = 0; i < clients_numb; ++i)
+		h.connect(url.c_str(), &state.clients[i]);
+
+	// Closes every connection at the deadline, frames still in flight are not counted
+	uS::Timer *deadline = new uS::Timer(h.getLoop());
+	deadline->start([](uS::Timer *timer)
+	{
+		state.deadline_reached = true;
+
+		for (unsigned int i = 0; i < state.clients.size(); ++i)
+		{
+			Client &client = state.clients[i];
+
+			if (client.timer)
+			{
+				client.timer->stop();
+				client.timer->close();
+				client.timer = nullptr;
+			}
+			if (client.ws)
+				client.ws->close();
+		}
+		timer->stop();
+		timer->close();
+	}, int(seconds * 1000.0), 0);
+
+	h.run();
+
+	report(rate, seconds);
+	return 0;
+}
@@ -1,18 +1,74 @@
 #ifndef __MAP_H__
 #define __MAP_H__
 
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "hilbert.h"
+#include "scalar.h"
+
 struct Map 
 {
+	Map() : origin_x(0.0), origin_y(0.0) {}
+
 	struct single_landmark_s
 	{
 		single_landmark_s() : id_i(0), x_f(0.0), y_f(0.0) {}
 	
 		unsigned int id_i ; // Landmark ID
-		double x_f;			// Landmark x-position in the map (global coordinates)
-		double y_f;			// Landmark y-position in the map (global coordinates)
+		scalar_t x_f;		// Landmark x-position in the map (relative to the map origin)
+		scalar_t y_f;		// Landmark y-position in the map (relative to the map origin)
 	};
 
+	/*
+	 * Replaces the landmarks with the given global positions, moving the local origin
+	 * to the centre of their bounding box. The landmarks are stored in Hilbert curve order
+	 * over that box, so landmarks close in the plane are close in memory too; the ids are
+	 * kept, the input order is not.
+	 */
+	void set_landmarks(const double *x, const double *y, const unsigned int *id, const unsigned int &n)
+	{
+		landmark_list.resize(n);
+		origin_x = origin_y = 0.0;
+
+		if (n == 0)
+			return;
+
+		const double min_x = *std::min_element(x, x + n), max_x = *std::max_element(x, x + n);
+		const double min_y = *std::min_element(y, y + n), max_y = *std::max_element(y, y + n);
+
+		origin_x = 0.5 * (min_x + max_x);
+		origin_y = 0.5 * (min_y + max_y);
+
+		// Curve key in the high half, input position in the low half: ties keep the input order
+		const hilbert::Grid grid(min_x, min_y, max_x, max_y);
+		std::vector<uint64_t> order(n);
+
+		for (unsigned int i = 0; i < n; ++i)
+			order[i] = static_cast<uint64_t>(grid.key(x[i], y[i])) << 32 | i;
+		std::sort(order.begin(), order.end());
+
+		for (unsigned int i = 0; i < n; ++i)
+		{
+			const unsigned int k = static_cast<uint32_t>(order[i]);
+
+			landmark_list[i].id_i = id[k];
+			landmark_list[i].x_f  = to_local_x(x[k]);
+			landmark_list[i].y_f  = to_local_y(y[k]);
+		}
+	}
+	// Conversions between global and local (map origin relative) coordinates
+	double to_local_x (const double &x) const { return x - origin_x; }
+	double to_local_y (const double &y) const { return y - origin_y; }
+	double to_global_x(const double &x) const { return x + origin_x; }
+	double to_global_y(const double &y) const { return y + origin_y; }
+
 	std::vector<single_landmark_s> landmark_list ; // List of landmarks in the map
+
+	// Global position of the local frame origin, the centre of the landmarks' bounding box.
+	// Keeping coordinates small preserves precision under the float32 scalar policy.
+	double origin_x;
+	double origin_y;
 };
 
 #endif /* __MAP_H__ */
@@ -1,44 +1,36 @@
 #include "master.h"
 
-Master::Master():delta_t(0.0),sensor_range(0.0),particles_numb(0),port(0){}
+Master::Master():port(0),tcp_port(0),shm_capacity(64),stats_interval(0),messages_numb(0){}
 
-std::string Master::hasData(const std::string& s)
-{
-	auto found_null = s.find("null");
-	auto b1			= s.find_first_of("[");
-	auto b2			= s.find_first_of("]");
-
-	if (found_null != std::string::npos)
-		return "";
-
-	else if (b1 != std::string::npos && b2 != std::string::npos)
-		return s.substr(b1, b2 - b1 + 1);
-
-	return "";
-}
 void Master::read_cfg(const std::string &cfg_path)
 {
 	cfg.read_cfg(cfg_path);
 	
 	for (auto &r : cfg.mstringmap)
 	{	
-		if (r.first == "TIMESTEP")
-			delta_t = String2Float()(r.second);
-
-		else if (r.first == "SENSOR_RANGE")
-			sensor_range = String2Int()(r.second);
+		if (filter_cfg.set(r.first, r.second))
+			continue;
 
-		else if (r.first == "PARTICLES_NUMBER")
-			particles_numb = String2Int()(r.second);
+		if (r.first == "STATS_INTERVAL")
+			stats_interval = String2Int()(r.second);
 
 		else if (r.first == "PORT")
 			port = String2Int()(r.second);
 
-		else if (r.first == "GPS_STD")
-			sigma_pos = String2Array()(r.second);
+		else if (r.first == "UNIX_SOCKET")
+			unix_socket = r.second == "0" ? "" : r.second;
+
+		else if (r.first == "TCP_PORT")
+			tcp_port = String2Int()(r.second);
+
+		else if (r.first == "SHM_NAME")
+			shm_name = r.second == "0" ? "" : r.second;
 
-		else if (r.first == "LANDMARK_STD")
-			sigma_landmark= String2Array()(r.second);
+		else if (r.first == "SHM_CAPACITY")
+			shm_capacity = String2Int()(r.second);
+
+		else if (r.first == "CAPTURE_FILE")
+			capture_file = r.second == "0" ? "" : r.second;
 	}
 }
 void Master::run()
@@ -48,80 +40,79 @@ void Master::run()
 	
 	read_cfg("../data/cfg.txt");
 	
-	std::cout<<"TimeStep        = "<<delta_t<<std::endl;
-	std::cout<<"Sensor Range    = "<<sensor_range<<std::endl;
-	std::cout<<"Particles Number= "<<particles_numb<<std::endl;
+	std::cout<<"TimeStep        = "<<filter_cfg.delta_t<<std::endl;
+	std::cout<<"Sensor Range    = "<<filter_cfg.sensor_range<<std::endl;
+	std::cout<<"Particles Number= "<<filter_cfg.particles_numb<<std::endl;
+	std::cout<<"Scalar          = "<<ScalarPolicy::name()<<std::endl;
+	std::cout<<"Association     = "<<(filter_cfg.association == ASSOCIATION_KDTREE ? "kdtree" : "bruteforce")<<std::endl;
+	std::cout<<"Kernels         = "<<cpu_level_name(detect_cpu_level())<<" (host "<<cpu_level_name(host_cpu_level())<<")"<<std::endl;
+	std::cout<<"Threads         = "<<filter_cfg.threads_numb<<std::endl;
 	std::cout<<"Port            = "<<port<<std::endl;
-	std::cout<<"GPS Unct        = "<<sigma_pos<<std::endl;
-	std::cout<<"Landmark Unct   = "<<sigma_landmark<<std::endl;
-	
+	std::cout<<"Unix Socket     = "<<(unix_socket.empty() ? "off" : unix_socket)<<std::endl;
+	std::cout<<"TCP Port        = "<<tcp_port<<std::endl;
+	std::cout<<"Shared Memory   = "<<(shm_name.empty() ? "off" : shm_name)<<std::endl;
+	std::cout<<"Capture File    = "<<(capture_file.empty() ? "off" : capture_file)<<std::endl;
+	std::cout<<"Stats Interval  = "<<stats_interval<<(alloc_stats::enabled ? "" : " (allocation stats not built)")<<std::endl;
+	std::cout<<"GPS Unct        = "<<filter_cfg.sigma_pos<<std::endl;
+	std::cout<<"Landmark Unct   = "<<filter_cfg.sigma_landmark<<std::endl;
+
+	// Every connection gets a Session, they all run on one pool and query one engine
+	resources.reset(new FilterResources(filter_cfg, map));
+
+	if (!capture_file.empty())
+	{
+		capture.reset(new CaptureWriter());
+
+		if (!capture->open(capture_file))
+		{
+			std::cerr << "Failed to open capture file " << capture_file << std::endl;
+			capture.reset();
+		}
+	}
+
+#ifdef __linux__
+	if (!shm_name.empty())
+	{
+		shm.reset(new ShmTransport(filter_cfg, map, capture.get(), resources.get()));
+
+		if (shm->start(shm_name, shm_capacity))
+			std::cout << "Serving shared memory rings " << shm_name << "_req/_rsp" << std::endl;
+		else
+			std::cerr << "Failed to create shared memory rings " << shm_name << std::endl;
+	}
+	if (!unix_socket.empty() || tcp_port)
+	{
+		sockets.reset(new SocketTransport(filter_cfg, map, capture.get(), resources.get()));
+
+		if (!unix_socket.empty() && !sockets->listen_unix(unix_socket))
+			std::cerr << "Failed to listen to unix socket " << unix_socket << std::endl;
+
+		if (tcp_port && !sockets->listen_tcp(tcp_port))
+			std::cerr << "Failed to listen to tcp port " << tcp_port << std::endl;
+
+		if (!sockets->start())
+			std::cerr << "Failed to start the socket transport" << std::endl;
+	}
+#endif
 	
 	h.onMessage			([this](uWS::WebSocket<uWS::SERVER> ws, char *message, size_t length, uWS::OpCode opCode)
 	{
-		if (length && length > 2 && message[0] == '4' && message[1] == '2')
-		{	
-			auto s = hasData(std::string(message));	
-			if (s != "")
-			{
-				auto j = nlohmann::json::parse(s);
-				if (j[0].get<std::string>() == "telemetry")
-				{
-					
-					if (!pf.initialized())
-					{
-						const double sense_x	  = std::stod(j[1]["sense_x"].    get<std::string>());
-						const double sense_y	  = std::stod(j[1]["sense_y"].    get<std::string>());
-						const double sense_theta  = std::stod(j[1]["sense_theta"].get<std::string>());
-
-						pf.init(particles_numb,sense_x, sense_y, sense_theta, sigma_pos);
-					
-					}
-					else 
-					{
-						const double prv_velocity = std::stod(j[1]["previous_velocity"].get<std::string>());
-						const double prv_yawrate  = std::stod(j[1]["previous_yawrate"]. get<std::string>());
-
-						pf.prediction(delta_t, sigma_pos, prv_velocity, prv_yawrate);
-					}
-
-					std::string				 sense_observations_x = j[1]["sense_observations_x"];
-					std::string				 sense_observations_y = j[1]["sense_observations_y"];
-
-					std::vector<float>		 x_sense, y_sense;
-					std::istringstream		 iss_x(sense_observations_x), iss_y(sense_observations_y);
-
-					std::copy(std::istream_iterator<float>(iss_x), std::istream_iterator<float>(), std::back_inserter(x_sense));
-					std::copy(std::istream_iterator<float>(iss_y), std::istream_iterator<float>(), std::back_inserter(y_sense));
-
-					std::vector<LandmarkObs> noisy_observations(x_sense.size());
-					
-					for (unsigned int i = 0; i < x_sense.size(); ++i)
-						noisy_observations[i] = LandmarkObs(x_sense[i], y_sense[i], 0);
-
-				
-					pf.updateWeights(sensor_range, sigma_landmark, noisy_observations, map);
-					pf.resample();
-
-					Particle best_particle(pf.get_best_particle());
-					
-					nlohmann::json msgJson;
-					msgJson["best_particle_x"]			  = best_particle.x;
-					msgJson["best_particle_y"]			  = best_particle.y;
-					msgJson["best_particle_theta"]		  = best_particle.theta;
-					msgJson["best_particle_associations"] = pf.getAssociations(best_particle);
-					msgJson["best_particle_sense_x"]	  = pf.getSenseX(best_particle);
-					msgJson["best_particle_sense_y"]	  = pf.getSenseY(best_particle);
-
-					auto msg = "42[\"best_particle\"," + msgJson.dump() + "]";
-					ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-						
-				}
-			}
-			else
-			{
-				const std::string msg = "42[\"manual\",{}]";
-				ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
-			}
+		alloc_report.begin();
+
+		Session *session = static_cast<Session*>(ws.getData());
+
+		std::string msg;
+		const bool replied = session && session->handle_message(message, length, msg);
+
+		if (replied)
+			ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+
+		alloc_report.end();
+
+		if (replied && stats_interval && ++messages_numb % stats_interval == 0)
+		{
+			alloc_report.print(std::cout, "message");
+			alloc_report.clear();
 		}
 	});
 	h.onHttpRequest		([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data, size_t, size_t)
@@ -136,10 +127,14 @@ void Master::run()
 	});
 	h.onConnection		([this](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req)
 	{
+		// Every simulator connection localizes its own vehicle
+		ws.setData(new Session(filter_cfg, map, capture.get(), resources.get()));
 		std::cout << "Connected!!!" << std::endl;
 	});
 	h.onDisconnection	([this](uWS::WebSocket<uWS::SERVER> ws, int code, char *message, size_t length) 
 	{
+		delete static_cast<Session*>(ws.getData());
+		ws.setData(nullptr);
 		ws.close();
 		std::cout << "Disconnected" << std::endl;
 	});
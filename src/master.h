@@ -4,8 +4,14 @@
 #include <uWS/uWS.h>
 #include "json.hpp"
 #include "helper_functions.h"
-#include "particle_filter.h"
+#include "session.h"
 #include "config.h"
+#include "alloc_stats.h"
+#include "capture.h"
+#ifdef __linux__
+#include "shm_transport.h"
+#include "socket_transport.h"
+#endif
 
 class Master
 {
@@ -16,7 +22,6 @@ public:
 	void run					 ();
 private:
 
-	std::string hasData			 (const std::string &s);
 	void read_cfg				 (const std::string &cfg_path);
 	
 	
@@ -24,20 +29,28 @@ private:
 
 	Map						     map;
 	Config 						 cfg;
-	ParticleFilter				 pf;
+	FilterConfig				 filter_cfg;
 
 	std::fstream				 in;
 	std::istringstream			 iss;
 	std::string					 buff;
 
-	double				 		delta_t;				// Time elapsed between measurements [sec]
-	double				 		sensor_range;			// Sensor range [m]
-	unsigned int 			 	particles_numb;
-
-	std::vector<double>	 		sigma_pos;				// GPS measurement uncertainty [x [m], y [m], theta [rad]]
-	std::vector<double>	 		sigma_landmark;			// Landmark measurement uncertainty [x [m], y [m]]
-
 	unsigned int			 	port;
+	std::string					unix_socket;			// Unix domain socket path, empty disables
+	unsigned int				tcp_port;				// Binary framing TCP port, 0 disables
+	std::string					shm_name;				// Shared memory transport ring name prefix, empty disables
+	unsigned int				shm_capacity;			// Slots per shared memory ring
+	std::string					capture_file;			// Telemetry capture path, empty disables
+	std::unique_ptr<CaptureWriter> capture;
+	std::unique_ptr<FilterResources> resources;		// Pool and engine of every session
+#ifdef __linux__
+	std::unique_ptr<ShmTransport> shm;
+	std::unique_ptr<SocketTransport> sockets;
+#endif
+
+	unsigned int				stats_interval;			// Print allocation stats every N messages, 0 disables
+	unsigned long				messages_numb;
+	alloc_stats::Report			alloc_report;
 };
 
 
@@ -0,0 +1,47 @@
+#include "numa.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+std::vector<std::vector<unsigned int>> numa::node_cpus()
+{
+	std::vector<std::vector<unsigned int>> nodes;
+
+	// Nodes are numbered densely on every machine we run on, the first missing one ends the scan
+	for (unsigned int node = 0; ; ++node)
+	{
+		char path[64];
+		std::snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+
+		std::ifstream in(path);
+		std::string	  list;
+		if (!in || !std::getline(in, list))
+			break;
+
+		// cpulist is a comma separated list of CPUs and ranges, e.g. 0-3,8-11
+		std::vector<unsigned int> cpus;
+		std::istringstream		  iss(list);
+		std::string				  range;
+
+		while (std::getline(iss, range, ','))
+		{
+			unsigned int first = 0, last = 0;
+			const int	 fields = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+
+			if (fields < 1)
+				continue;
+			if (fields == 1)
+				last = first;
+
+			for (unsigned int cpu = first; cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+		}
+
+		// Memory-only nodes have no CPU to pin to
+		if (!cpus.empty())
+			nodes.push_back(cpus);
+	}
+	return nodes;
+}
@@ -0,0 +1,47 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+ * NUMA placement without libnuma: the topology comes from /sys/devices/system/node and
+ * pages are placed by first touch, i.e. on the node of the thread that writes them first.
+ */
+namespace numa
+{
+	/**
+	 * node_cpus Returns the CPUs of every NUMA node, one entry per node. Empty when the
+	 *   topology is not exposed (non-Linux hosts, containers without /sys).
+	 */
+	std::vector<std::vector<unsigned int>> node_cpus();
+
+	/*
+	 * Allocator whose value-less construct() default-initializes, so resizing a vector of
+	 * scalars leaves the new pages untouched for the owning threads to touch first.
+	 */
+	template<typename T>
+	struct Allocator : std::allocator<T>
+	{
+		template<typename U>
+		struct rebind { typedef Allocator<U> other; };
+
+		Allocator() {}
+		template<typename U>
+		Allocator(const Allocator<U>&) {}
+
+		template<typename U>
+		void construct(U *p)
+		{
+			::new(static_cast<void*>(p)) U;
+		}
+		template<typename U, typename... Args>
+		void construct(U *p, Args&&... args)
+		{
+			::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+		}
+	};
+}
+
+#endif /* __NUMA_H__ */
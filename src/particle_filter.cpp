@@ -1,225 +1,1291 @@
 #include "particle_filter.h"
+#include <cstring>
+
+namespace
+{
+	// Smallest chunks the pool splits particle loops into; the particle arrays are first-touched,
+	// predicted, gathered and reduced in the same chunks, so each chunk stays with one thread
+	const unsigned int PARTICLE_GRAIN	= 4096;
+	const unsigned int WEIGHT_GRAIN		= 64;		// Weighing a particle costs a range query; NUMA mode keeps PARTICLE_GRAIN
+	const unsigned int DRAW_BLOCK		= 4096;		// Ancestor draws per seeded generator
+	const unsigned int SORT_BITS		= 16;		// Particles are sorted on a 256 x 256 cell curve over their bounding box
+	const double	   CACHE_SLACK		= 1e-3;		// Relative widening of cached queries, covers the rounding of the distance tests
+
+	// out[run_end[r - 1], run_end[r]) = unique[r] for every run
+	template<typename T>
+	void expand_runs(const T *unique, const unsigned int *run_end, const unsigned int &runs, T *out)
+	{
+		unsigned int i = 0;
+		for (unsigned int r = 0; r < runs; ++r)
+		{
+			std::fill(out + i, out + run_end[r], unique[r]);
+			i = run_end[r];
+		}
+	}
+}
 
 void ParticleFilter::init(const unsigned int &particles_numb, const double &x, const double &y,const double &theta, const std::vector<double>& std) 
 {
+	allocate(particles_numb);
+
+	std::normal_distribution<scalar_t> dist_x(x,		 std[0]);
+	std::normal_distribution<scalar_t> dist_y(y,		 std[1]);
+	std::normal_distribution<scalar_t> dist_theta(theta, std[2]);
+
+	for (unsigned int i = 0; i < num_particles; ++i) 
+	{
+		ids[i]		= i;
+		xs[i]		= dist_x(gen);
+		ys[i]		= dist_y(gen);
+		thetas[i]	= dist_theta(gen);
+		weights[i] 	= 1.0;
+	}
+
+	// Island generators are seeded from the filter's, so one seed still reproduces a run
+	for (unsigned int k = 0; k < island.size(); ++k)
+		island[k].gen.seed(gen());
+
+	is_initialized = true;
+}
+void ParticleFilter::allocate(const unsigned int &particles_numb)
+{
+	const unsigned int previous = std::min<size_t>(num_particles, xs.capacity());
+	const size_t	   capacity = xs.capacity();
+
 	num_particles = particles_numb;
+
+	ids.resize(num_particles);
+	xs.resize(num_particles);
+	ys.resize(num_particles);
+	thetas.resize(num_particles);
 	weights.resize(num_particles);
-	particles.resize(num_particles);
 
-	gen = std::mt19937(rd());
+	back_ids.resize(num_particles);
+	back_xs.resize(num_particles);
+	back_ys.resize(num_particles);
+	back_thetas.resize(num_particles);
+	back_weights.resize(num_particles);
+	indices.resize(num_particles);
+	sort_keys.resize(num_particles);
+	sort_keys_tmp.resize(num_particles);
+	sort_order_tmp.resize(num_particles);
+	run_end.resize(num_particles);
 
-	std::normal_distribution<double> dist_x(x,		   std[0]);
-	std::normal_distribution<double> dist_y(y,		   std[1]);
-	std::normal_distribution<double> dist_theta(theta, std[2]);
+	// Callers reading the particles expand them first, a resized set is plain arrays again
+	compact = false;
 
-	for (unsigned int i = 0; i < num_particles; ++i) 
+	noise_x.resize(num_particles);
+	noise_y.resize(num_particles);
+	noise_theta.resize(num_particles);
+
+	// Reallocated arrays: the preserved prefix was copied by this thread, the rest is still untouched
+	if (numa_enabled && xs.capacity() != capacity)
+		first_touch(previous);
+
+	// Never more islands than particles
+	const unsigned int islands_used = islands_numb > 1 ? std::min(islands_numb, num_particles) : 0;
+	island.resize(islands_used);
+
+	for (unsigned int k = 0; k < islands_used; ++k)
 	{
-		particles[i].id		= i;
-		particles[i].x		= dist_x(gen);
-		particles[i].y		= dist_y(gen);
-		particles[i].theta	= dist_theta(gen);
-		particles[i].weight = 1.0;	
-		weights[i] 			= 1.0;
+		island[k].begin = static_cast<unsigned long>(k)		* num_particles / islands_used;
+		island[k].end	= static_cast<unsigned long>(k + 1) * num_particles / islands_used;
+		island[k].order.reserve(island[k].end - island[k].begin);
 	}
-	is_initialized = true;
 }
 void ParticleFilter::prediction(const double & delta_t, const std::vector<double>&std_pos, const double & velocity, const double & yaw_rate) 
 {
-	double x = 0.0, y = 0.0, theta = 0.0;
+	// A compact segment expands its runs; with multiplicity the plain arrays go through the same kernel
+	// as runs of one, so a set restored from a checkpoint moves bit for bit as the compact one would have
+	auto predict = [&](const unsigned int &begin, const unsigned int &end, const int &segment)
+	{
+		if (!multiplicity)
+		{
+			kernels->predict(end - begin, xs.data() + begin, ys.data() + begin, thetas.data() + begin,
+							 noise_x.data() + begin, noise_y.data() + begin, noise_theta.data() + begin, velocity, yaw_rate, delta_t);
+		}
+		else if (segment < 0)
+		{
+			kernels->predict_runs(end - begin, nullptr, xs.data() + begin, ys.data() + begin, thetas.data() + begin, xs.data() + begin, ys.data() + begin, thetas.data() + begin,
+								  noise_x.data() + begin, noise_y.data() + begin, noise_theta.data() + begin, velocity, yaw_rate, delta_t);
+		}
+		else
+		{
+			const unsigned int runs = segment_runs[segment];
 
-	for (unsigned int i = 0; i < num_particles; ++i) 
+			kernels->predict_runs(runs, run_end.data() + begin, back_xs.data() + begin, back_ys.data() + begin, back_thetas.data() + begin, xs.data() + begin, ys.data() + begin, thetas.data() + begin,
+								  noise_x.data() + begin, noise_y.data() + begin, noise_theta.data() + begin, velocity, yaw_rate, delta_t);
+			expand_runs(back_ids.data()		+ begin, run_end.data() + begin, runs, ids.data()	  + begin);
+			expand_runs(back_weights.data() + begin, run_end.data() + begin, runs, weights.data() + begin);
+		}
+	};
+
+	if (island.empty())
 	{
-		if (std::fabs(yaw_rate) > 0.001) 
+		draw_noise(0, num_particles, gen, std_pos);
+
+		if (compact)
 		{
-			x 		= particles[i].x 	  + (velocity / yaw_rate) * (std::sin(particles[i].theta  + yaw_rate * delta_t) - std::sin(particles[i].theta));
-			y 		= particles[i].y 	  + (velocity / yaw_rate) * (std::cos(particles[i].theta) - std::cos(particles[i].theta + yaw_rate * delta_t));
-			theta 	= particles[i].theta  + yaw_rate  * delta_t;
+			auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+			{
+				for (unsigned int k = begin; k < end; ++k)
+					predict(segment_first[k], k + 1 < segment_first.size() ? segment_first[k + 1] : num_particles, k);
+			};
+			pool->parallel_for(segment_first.size(), 1, task);
 		}
-		else 
+		else
 		{
-			x	   = particles[i].x		  + velocity * delta_t * std::cos(particles[i].theta);
-			y	   = particles[i].y		  + velocity * delta_t * std::sin(particles[i].theta);
-			theta  = particles[i].theta   + yaw_rate * delta_t;
+			auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+			{
+				predict(begin, end, -1);
+			};
+			pool->parallel_for(num_particles, PARTICLE_GRAIN, task);
 		}
+		compact = false;
+		return;
+	}
 
-		std::normal_distribution<double> dist_x(x,	   std_pos[0]);
-		std::normal_distribution<double> dist_y(y,	   std_pos[1]);
-		std::normal_distribution<double> dist_theta(theta, std_pos[2]);
-		
-		particles[i].x		   = dist_x(gen);
-		particles[i].y	       = dist_y(gen);
-		particles[i].theta     = dist_theta(gen);
+	auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		for (unsigned int k = begin; k < end; ++k)
+		{
+			const Island &is = island[k];
+			draw_noise(is.begin, is.end, island[k].gen, std_pos);
+			predict(is.begin, is.end, compact ? static_cast<int>(k) : -1);
+		}
+	};
+	pool->parallel_for(island.size(), 1, task);
+	compact = false;
+}
+void ParticleFilter::draw_noise(const unsigned int &begin, const unsigned int &end, std::mt19937 &generator, const std::vector<double> &std_pos)
+{
+	std::normal_distribution<scalar_t> dist_x(0,	 std_pos[0]);
+	std::normal_distribution<scalar_t> dist_y(0,	 std_pos[1]);
+	std::normal_distribution<scalar_t> dist_theta(0, std_pos[2]);
+
+	// The generator is sequential, so noise is drawn up front and the motion model runs as a kernel
+	for (unsigned int i = begin; i < end; ++i) 
+	{
+		noise_x[i]	   = dist_x(generator);
+		noise_y[i]	   = dist_y(generator);
+		noise_theta[i] = dist_theta(generator);
 	}
 }
 void ParticleFilter::updateWeights(const double &sensor_range, const std::vector<double> &std_landmark, const std::vector<LandmarkObs> &observations,const Map &map_landmarks)
 {
-	double prob 	= 0.0;
-	double min_dist = 0.0;
-	int id_min 		= 0;
-	
-	for (unsigned int i = 0; i < num_particles; ++i)
+	obs_x.resize(observations.size());
+	obs_y.resize(observations.size());
+
+	for (unsigned int j = 0; j < observations.size(); ++j)
+	{
+		obs_x[j] = observations[j].x;
+		obs_y[j] = observations[j].y;
+	}
+
+	updateWeights(sensor_range, std_landmark, obs_x.data(), obs_y.data(), observations.size(), map_landmarks);
+}
+void ParticleFilter::updateWeights(const double &sensor_range, const std::vector<double> &std_landmark, const scalar_t *observations_x, const scalar_t *observations_y, const unsigned int &n_obs, const Map &map_landmarks)
+{
+	WeightParams params;
+	params.obs_x	= observations_x;
+	params.obs_y	= observations_y;
+	params.n_obs	= n_obs;
+	params.range	= sensor_range;
+	params.inv_2sx2 = 1.0 / (2.0 * std_landmark[0] * std_landmark[0]);
+	params.inv_2sy2 = 1.0 / (2.0 * std_landmark[1] * std_landmark[1]);
+	params.log_norm	= -std::log(2.0 * PI * std_landmark[0] * std_landmark[1]);
+
+	ensure_engine(map_landmarks);
+	expand();
+
+	if (island.empty())
 	{
-		std::vector<LandmarkObs> transform_obs(observations.size());
-		std::vector<LandmarkObs> closest_land;
-			
-		for (unsigned int j = 0; j < observations.size(); ++j)
+		chunk_scratch.resize(pool->size());
+
+		auto weigh_chunk = [&](unsigned int chunk, unsigned int begin, unsigned int end)
 		{
-			const double trans_obs_x = observations[j].x * std::cos(particles[i].theta) - observations[j].y * std::sin(particles[i].theta) + particles[i].x;
-			const double trans_obs_y = observations[j].x * std::sin(particles[i].theta) + observations[j].y * std::cos(particles[i].theta) + particles[i].y;
+			weigh(begin, end, params, chunk_scratch[chunk]);
+		};
+		// Finer chunks balance the range queries better, but under NUMA they would cross the pages other threads first-touched
+		pool->parallel_for(num_particles, numa_enabled ? PARTICLE_GRAIN : WEIGHT_GRAIN, weigh_chunk);
+		return;
+	}
+
+	auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		for (unsigned int k = begin; k < end; ++k)
+			weigh(island[k].begin, island[k].end, params, island[k].scratch);
+	};
+	pool->parallel_for(island.size(), 1, task);
+}
+void ParticleFilter::ensure_engine(const Map &map_landmarks)
+{
+	if (association->built_for() == &map_landmarks)
+		return;
+
+	// A shared engine stays built for the map of the other filters
+	if (association.use_count() > 1)
+		association.reset(make_association_engine(association->type()));
+
+	association->build(map_landmarks);
+	++map_generation;
+}
+void ParticleFilter::weigh(const unsigned int &begin, const unsigned int &end, const WeightParams &params, WeightScratch &scratch)
+{
+	// Scratch buffers keep their capacity between frames, so once warmed up no heap allocation happens here.
+	// The landmark set grows to the most landmarks seen in range rather than the map size, one per island
+	scratch.trans_x.resize(params.n_obs);
+	scratch.trans_y.resize(params.n_obs);
+
+	const LandmarkSet *cache = cache_margin > 0.0 && refresh_cache(begin, end, params, scratch) ? &scratch.cache_land : nullptr;
+
+	if (bucket_size > 0.0)
+	{
+		weigh_buckets(begin, end, params, scratch, cache);
+		return;
+	}
+
+	for (unsigned int i = begin; i < end; ++i)
+	{
+		scratch.closest_land.clear();
+		in_range(xs[i], ys[i], params.range, cache, scratch.closest_land);
+
+		weights[i] = likelihood(i, params, scratch);
+	}
+}
+bool ParticleFilter::refresh_cache(const unsigned int &begin, const unsigned int &end, const WeightParams &params, WeightScratch &scratch)
+{
+	if (begin == end)
+		return false;
+
+	scalar_t min_x = xs[begin], max_x = xs[begin];
+	scalar_t min_y = ys[begin], max_y = ys[begin];
+
+	for (unsigned int i = begin + 1; i < end; ++i)
+	{
+		min_x = std::min(min_x, xs[i]);
+		max_x = std::max(max_x, xs[i]);
+		min_y = std::min(min_y, ys[i]);
+		max_y = std::max(max_y, ys[i]);
+	}
+
+	// Circle around the particles' bounding box
+	const double centre_x = 0.5 * (static_cast<double>(min_x) + max_x);
+	const double centre_y = 0.5 * (static_cast<double>(min_y) + max_y);
+	const double radius	  = 0.5 * std::hypot(static_cast<double>(max_x) - min_x, static_cast<double>(max_y) - min_y);
+
+	++scratch.cache_updates;
 
-			transform_obs[j] = LandmarkObs(trans_obs_x,trans_obs_y,-1);		
+	// A landmark in range of a particle is within range + radius + moved of the cached centre
+	const double moved = std::hypot(centre_x - scratch.cache_x, centre_y - scratch.cache_y);
+
+	if (scratch.cache_generation == map_generation && scratch.cache_range == params.range && params.range + radius + moved <= scratch.cache_reach)
+	{
+		++scratch.cache_hits;
+		return true;
+	}
+
+	// Wider than the sensor, the chunk would cache a good part of the map
+	if (radius > params.range)
+		return false;
+
+	scratch.cache_x			 = centre_x;
+	scratch.cache_y			 = centre_y;
+	scratch.cache_reach		 = params.range + radius + cache_margin;
+	scratch.cache_range		 = params.range;
+	scratch.cache_generation = map_generation;
+
+	scratch.cache_land.clear();
+	association->in_range(centre_x, centre_y, scratch.cache_reach * (1.0 + CACHE_SLACK), scratch.cache_land);
+	return true;
+}
+void ParticleFilter::in_range(const scalar_t &x, const scalar_t &y, const scalar_t &range, const LandmarkSet *cache, LandmarkSet &out) const
+{
+	if (!cache)
+	{
+		association->in_range(x, y, range, out);
+		return;
+	}
+
+	// The engines' own test on a superset of their answer; both engines return landmarks in a fixed
+	// order (map order, or kd-tree pre-order) whatever the query, so the filtered set is in that order too
+	const scalar_t r2 = range * range;
+
+	for (unsigned int j = 0; j < cache->size(); ++j)
+		if ((cache->x[j] - x) * (cache->x[j] - x) + (cache->y[j] - y) * (cache->y[j] - y) < r2)
+			out.push_back(cache->x[j], cache->y[j], cache->id[j]);
+}
+void ParticleFilter::weigh_buckets(const unsigned int &begin, const unsigned int &end, const WeightParams &params, WeightScratch &scratch, const LandmarkSet *cache)
+{
+	const double inv_size = 1.0 / bucket_size;
+
+	// Cells as biased 32-bit column and row, sorted so the particles of a cell are consecutive
+	scratch.cells.resize(end - begin);
+	for (unsigned int i = begin; i < end; ++i)
+	{
+		const uint32_t cx = static_cast<uint32_t>(static_cast<int32_t>(std::floor(xs[i] * inv_size))) ^ 0x80000000u;
+		const uint32_t cy = static_cast<uint32_t>(static_cast<int32_t>(std::floor(ys[i] * inv_size))) ^ 0x80000000u;
+
+		scratch.cells[i - begin] = std::make_pair(static_cast<uint64_t>(cx) << 32 | cy, i);
+	}
+	std::sort(scratch.cells.begin(), scratch.cells.end());
+
+	// Any landmark within range of a particle is within range + half the cell diagonal of the cell centre;
+	// a whole cell size of margin also covers the rounding of the centre
+	const scalar_t query_range = params.range + bucket_size;
+	const scalar_t r2		   = params.range * params.range;
+
+	for (unsigned int c = 0; c < scratch.cells.size(); )
+	{
+		const uint64_t cell		= scratch.cells[c].first;
+		const double   centre_x = (static_cast<int32_t>((cell >> 32) ^ 0x80000000u) + 0.5) * bucket_size;
+		const double   centre_y = (static_cast<int32_t>((cell & 0xFFFFFFFFu) ^ 0x80000000u) + 0.5) * bucket_size;
+
+		scratch.bucket_land.clear();
+		in_range(centre_x, centre_y, query_range, cache, scratch.bucket_land);
+
+		const LandmarkSet &candidates = scratch.bucket_land;
+
+		for (; c < scratch.cells.size() && scratch.cells[c].first == cell; ++c)
+		{
+			const unsigned int i = scratch.cells[c].second;
+			const scalar_t	   x = xs[i], y = ys[i];
+
+			// The engines' own test, so the particle keeps exactly the landmarks its own query would return
+			scratch.closest_land.clear();
+			for (unsigned int j = 0; j < candidates.size(); ++j)
+				if ((candidates.x[j] - x) * (candidates.x[j] - x) + (candidates.y[j] - y) * (candidates.y[j] - y) < r2)
+					scratch.closest_land.push_back(candidates.x[j], candidates.y[j], candidates.id[j]);
+
+			weights[i] = likelihood(i, params, scratch);
 		}
-	
-		for (unsigned int j = 0; j < map_landmarks.landmark_list.size(); ++j) 
+	}
+}
+double ParticleFilter::likelihood(const unsigned int &i, const WeightParams &params, WeightScratch &scratch)
+{
+	const unsigned int n_obs = params.n_obs;
+
+	kernels->transform(n_obs, params.obs_x, params.obs_y, xs[i], ys[i], thetas[i], scratch.trans_x.data(), scratch.trans_y.data());
+
+	// Every landmark in range is matched with its nearest observation; the product of the
+	// bivariate normals is evaluated as one exp of the summed exponents and normalizers
+	const LandmarkSet &closest_land = scratch.closest_land;
+	const unsigned int n_land		= closest_land.size();
+	double prob = 1.0;
+
+	if (scratch.min_d2.size() < n_land)
+	{
+		scratch.min_d2.resize(n_land);
+		scratch.expo.resize(n_land);
+	}
+
+	if (n_obs != 0 && n_land != 0)
+	{
+		const double sum = kernels->exponent(n_land, closest_land.x.data(), closest_land.y.data(), n_obs, scratch.trans_x.data(), scratch.trans_y.data(),
+											 params.inv_2sx2, params.inv_2sy2, scratch.min_d2.data(), scratch.expo.data());
+		prob = std::exp(n_land * params.log_norm - sum);
+	}
+	return prob;
+}
+void ParticleFilter::resample() 
+{
+	expand();
+	++resamples;
+
+	// Sorting reorders the expanded set, so a resample followed by a sort stays plain
+	const bool sort_due = sort_interval != 0 && resamples % sort_interval == 0;
+	const bool runs		= multiplicity && !sort_due;
+
+	if (island.empty())
+	{
+		if (!pick(0, num_particles, gen, alias_table, pool))
+			return;
+
+		if (runs)
 		{
-			const double landmark_part_dist = dist(particles[i].x, particles[i].y, map_landmarks.landmark_list[j].x_f, map_landmarks.landmark_list[j].y_f);
-			if (landmark_part_dist < sensor_range) 	
-			{
-				LandmarkObs pred_landmark;
-				pred_landmark.id = map_landmarks.landmark_list[j].id_i;
-				pred_landmark.x = map_landmarks.landmark_list[j].x_f;
-				pred_landmark.y = map_landmarks.landmark_list[j].y_f;
+			segment_first.resize(pool->size());
+			segment_runs.resize(pool->size());
 
-				closest_land.push_back(pred_landmark);
-			}						
+			auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+			{
+				segment_first[chunk] = begin;
+				segment_runs[chunk]	 = compact_range(0, begin, end);
+			};
+			segment_first.resize(pool->parallel_for(num_particles, PARTICLE_GRAIN, task));
+			compact = true;
+			return;
 		}
-		
-		dataAssociation(closest_land, transform_obs);
-		prob = 1.0;
-		for (unsigned int j = 0; j < closest_land.size(); ++j)
+
+		// Systematic ancestors of a chunk mostly lie in that chunk, so the copies stay in-node; the other resamplers' land anywhere
+		auto gather = [&](unsigned int chunk, unsigned int begin, unsigned int end)
 		{
-			id_min 		= -1;
-			min_dist 	= 99999;
+			gather_range(0, begin, end);
+		};
+		pool->parallel_for(num_particles, PARTICLE_GRAIN, gather);
+	}
+	else
+	{
+		if (migration_interval != 0 && migration_rate > 0.0 && resamples % migration_interval == 0)
+			migrate();
 
-			for (unsigned int k = 0; k < transform_obs.size(); ++k) 
-			{	
-				const double m_dist = dist(closest_land[j].x, closest_land[j].y, transform_obs[k].x, transform_obs[k].y);
+		segment_first.resize(island.size());
+		segment_runs.resize(island.size());
 
-				if (m_dist < min_dist)
+		// An island whose weights all vanished keeps its particles
+		auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+		{
+			for (unsigned int k = begin; k < end; ++k)
+			{
+				const Island &is = island[k];
+				if (runs)
 				{
-					min_dist = m_dist;
-					id_min = k;
+					if (!pick(is.begin, is.end, island[k].gen, island[k].table))
+						for (unsigned int i = is.begin; i < is.end; ++i)
+							indices[i] = i - is.begin;
+
+					segment_first[k] = is.begin;
+					segment_runs[k]	 = compact_range(is.begin, is.begin, is.end);
+					continue;
 				}
+				if (resample_range(is.begin, is.end, island[k].gen, island[k].table))
+					continue;
+
+				std::copy(ids.begin()	  + is.begin, ids.begin()	  + is.end, back_ids.begin()	 + is.begin);
+				std::copy(xs.begin()	  + is.begin, xs.begin()	  + is.end, back_xs.begin()		 + is.begin);
+				std::copy(ys.begin()	  + is.begin, ys.begin()	  + is.end, back_ys.begin()		 + is.begin);
+				std::copy(thetas.begin()  + is.begin, thetas.begin()  + is.end, back_thetas.begin()	 + is.begin);
+				std::copy(weights.begin() + is.begin, weights.begin() + is.end, back_weights.begin() + is.begin);
 			}
-			if (id_min != -1)
-				prob *= bivariate_normal(closest_land[j].x, closest_land[j].y, transform_obs[id_min].x, transform_obs[id_min].y, std_landmark[0], std_landmark[1]);
+		};
+		pool->parallel_for(island.size(), 1, task);
+
+		if (runs)
+		{
+			compact = true;
+			return;
 		}
+	}
+
+	ids.swap(back_ids);
+	xs.swap(back_xs);
+	ys.swap(back_ys);
+	thetas.swap(back_thetas);
+	weights.swap(back_weights);
 
-		weights[i] 			= prob;
-		particles[i].weight = prob;	
+	if (sort_due)
+		sort_particles();
+}
+void ParticleFilter::resample(const unsigned int &particles_numb)
+{
+	expand();
+
+	if (particles_numb == num_particles)
+	{
+		resample();
+		return;
+	}
+	if (num_particles == 0)
+		return;
+
+	if (particles_numb == 0)
+	{
+		allocate(0);
+		return;
 	}
+
+	++resamples;
+
+	const unsigned int n		   = num_particles;
+	const double	   sum_weights = std::accumulate(weights.begin(), weights.begin() + n, 0.0);
+
+	indices.resize(particles_numb);
+
+	// Systematic resampling with particles_numb pointers over the n cumulative weights, or as many
+	// draws of the other resamplers; without any weight the particles are spread evenly instead
+	const bool drawn = resampler != RESAMPLER_SYSTEMATIC && draw_ancestors(weights.data(), n, particles_numb, gen, alias_table, pool, indices.data());
+
+	if (!drawn && sum_weights > 0.0)
+	{
+		const double step = sum_weights / particles_numb;
+
+		std::uniform_real_distribution<double> dist_start(0.0, step);
+
+		double		 pointer	= dist_start(gen);
+		double		 cumulative = weights[0];
+		unsigned int index		= 0;
+
+		for (unsigned int i = 0; i < particles_numb; ++i)
+		{
+			while (pointer > cumulative && index < n - 1)
+				cumulative += weights[++index];
+
+			indices[i]	= index;
+			pointer	   += step;
+		}
+	}
+	else if (!drawn)
+	{
+		for (unsigned int i = 0; i < particles_numb; ++i)
+			indices[i] = static_cast<unsigned long>(i) * n / particles_numb;
+	}
+
+	back_ids.resize(particles_numb);
+	back_xs.resize(particles_numb);
+	back_ys.resize(particles_numb);
+	back_thetas.resize(particles_numb);
+	back_weights.resize(particles_numb);
+
+	auto gather = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		gather_range(0, begin, end);
+	};
+	pool->parallel_for(particles_numb, PARTICLE_GRAIN, gather);
+
+	ids.swap(back_ids);
+	xs.swap(back_xs);
+	ys.swap(back_ys);
+	thetas.swap(back_thetas);
+	weights.swap(back_weights);
+
+	allocate(particles_numb);
+
+	if (sort_interval != 0 && resamples % sort_interval == 0)
+		sort_particles();
 }
-void ParticleFilter::resample() 
+void ParticleFilter::take_particles(const unsigned int &count, std::vector<Particle> &out)
+{
+	expand();
+
+	const unsigned int n	 = num_particles;
+	const unsigned int taken = std::min(count, n);
+	unsigned int	   kept	 = 0;
+
+	// Particle i leaves when i * taken / n steps to the next integer, exactly taken of them over the set
+	for (unsigned int i = 0; i < n && taken != 0; ++i)
+	{
+		if (static_cast<unsigned long>(i + 1) * taken / n != static_cast<unsigned long>(i) * taken / n)
+		{
+			out.push_back(particle(i));
+			continue;
+		}
+
+		ids[kept]	  = ids[i];
+		xs[kept]	  = xs[i];
+		ys[kept]	  = ys[i];
+		thetas[kept]  = thetas[i];
+		weights[kept] = weights[i];
+		++kept;
+	}
+
+	if (taken != 0)
+		allocate(kept);
+}
+void ParticleFilter::add_particles(const Particle *particles, const unsigned int &count)
+{
+	expand();
+
+	const unsigned int n = num_particles;
+	allocate(n + count);
+
+	for (unsigned int j = 0; j < count; ++j)
+	{
+		ids[n + j]	   = particles[j].id;
+		xs[n + j]	   = particles[j].x;
+		ys[n + j]	   = particles[j].y;
+		thetas[n + j]  = particles[j].theta;
+		weights[n + j] = particles[j].weight;
+	}
+}
+bool ParticleFilter::resample_range(const unsigned int &begin, const unsigned int &end, std::mt19937 &generator, AliasTable &table)
+{
+	if (!pick(begin, end, generator, table))
+		return false;
+
+	gather_range(begin, begin, end);
+	return true;
+}
+bool ParticleFilter::pick(const unsigned int &begin, const unsigned int &end, std::mt19937 &generator, AliasTable &table, ThreadPool *draw_pool)
+{
+	const unsigned int n = end - begin;
+
+	if (resampler != RESAMPLER_SYSTEMATIC)
+		return draw_ancestors(weights.data() + begin, n, n, generator, table, draw_pool, indices.data() + begin);
+
+	// Systematic (low variance) resampling: a single uniform draw and one pass over the
+	// cumulative weights, so no distribution object has to be built every frame
+	const double sum_weights = std::accumulate(weights.begin() + begin, weights.begin() + end, 0.0);
+
+	if (sum_weights <= 0.0)
+		return false;
+
+	const double step = sum_weights / n;
+
+	std::uniform_real_distribution<double> dist_start(0.0, step);
+
+	kernels->systematic(n, weights.data() + begin, dist_start(generator), step, indices.data() + begin);
+	return true;
+}
+bool ParticleFilter::draw_ancestors(const double *w, const unsigned int &n, const unsigned int &count, std::mt19937 &generator, AliasTable &table,
+									ThreadPool *draw_pool, unsigned int *ancestors)
+{
+	const bool parallel = draw_pool && count > DRAW_BLOCK;
+	double	   max_weight = 0.0;
+
+	if (resampler == RESAMPLER_ALIAS)
+	{
+		if (!table.build(w, n, draw_pool))
+			return false;
+	}
+	else if (parallel)
+	{
+		// The maximum is the only reduction, it tells a set without weight apart and bounds the rejection sampler
+		chunk_max.assign(draw_pool->size(), 0.0);
+
+		auto reduce = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+		{
+			chunk_max[chunk] = *std::max_element(w + begin, w + end);
+		};
+		draw_pool->parallel_for(n, PARTICLE_GRAIN, reduce);
+
+		max_weight = *std::max_element(chunk_max.begin(), chunk_max.end());
+	}
+	else
+		max_weight = *std::max_element(w, w + n);
+
+	if (resampler != RESAMPLER_ALIAS && !(max_weight > 0.0))
+		return false;
+
+	auto draw = [&](std::mt19937 &block_gen, const unsigned int &first, const unsigned int &last)
+	{
+		if (resampler == RESAMPLER_ALIAS)
+		{
+			for (unsigned int i = first; i < last; ++i)
+				ancestors[i] = table.draw(block_gen);
+		}
+		else if (resampler == RESAMPLER_METROPOLIS)
+			resampling::metropolis(w, n, resampler_iterations, block_gen, first, last, ancestors);
+		else
+			resampling::rejection(w, n, max_weight, resampler_iterations, block_gen, first, last, ancestors);
+	};
+
+	if (!parallel)
+	{
+		draw(generator, 0, count);
+		return true;
+	}
+
+	// Fixed blocks of draws, each with a generator seeded from this one, keep the draws independent of the thread count
+	const unsigned int blocks = (count + DRAW_BLOCK - 1) / DRAW_BLOCK;
+
+	draw_seeds.resize(blocks);
+	for (unsigned int b = 0; b < blocks; ++b)
+		draw_seeds[b] = generator();
+
+	auto task = [&](unsigned int chunk, unsigned int block_begin, unsigned int block_end)
+	{
+		for (unsigned int b = block_begin; b < block_end; ++b)
+		{
+			std::mt19937 block_gen(draw_seeds[b]);
+			draw(block_gen, b * DRAW_BLOCK, std::min(count, (b + 1) * DRAW_BLOCK));
+		}
+	};
+	draw_pool->parallel_for(blocks, 1, task);
+	return true;
+}
+void ParticleFilter::gather_range(const unsigned int &base, const unsigned int &begin, const unsigned int &end)
+{
+	const unsigned int n	  = end - begin;
+	const unsigned int *picked = indices.data() + begin;
+
+	kernels->gather(n, picked, xs.data()	 + base, back_xs.data()		+ begin);
+	kernels->gather(n, picked, ys.data()	 + base, back_ys.data()		+ begin);
+	kernels->gather(n, picked, thetas.data() + base, back_thetas.data() + begin);
+
+	for (unsigned int i = 0; i < n; ++i)
+	{
+		back_ids[begin + i]		= ids[base + picked[i]];
+		back_weights[begin + i] = weights[base + picked[i]];
+	}
+}
+unsigned int ParticleFilter::compact_range(const unsigned int &base, const unsigned int &begin, const unsigned int &end)
+{
+	// A run closes when the ancestor changes; systematic ancestors are sorted, so every ancestor is one run
+	unsigned int runs = 0;
+
+	for (unsigned int i = begin; i < end; ++i)
+	{
+		if (i != begin && indices[i] == indices[i - 1])
+			continue;
+
+		if (runs != 0)
+			run_end[begin + runs - 1] = i - begin;
+
+		const unsigned int src = base + indices[i];
+		back_ids[begin + runs]	   = ids[src];
+		back_xs[begin + runs]	   = xs[src];
+		back_ys[begin + runs]	   = ys[src];
+		back_thetas[begin + runs]  = thetas[src];
+		back_weights[begin + runs] = weights[src];
+		++runs;
+	}
+	if (runs != 0)
+		run_end[begin + runs - 1] = end - begin;
+
+	return runs;
+}
+void ParticleFilter::expand()
 {
-	std::random_device 				rd_wts;
-	std::mt19937 					generator_wts(rd_wts());
-	
-	std::vector<Particle>			new_particles(num_particles);
-	std::discrete_distribution<int> index(weights.begin(), weights.end());
-	
+	if (!compact)
+		return;
 
-	for (unsigned int i = 0; i < num_particles; ++i)
-		new_particles[i] = particles[index(generator_wts)];
+	auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		for (unsigned int k = begin; k < end; ++k)
+		{
+			const unsigned int first = segment_first[k];
+			const unsigned int *ends = run_end.data() + first;
 
-	particles = new_particles;
+			expand_runs(back_ids.data()		+ first, ends, segment_runs[k], ids.data()	   + first);
+			expand_runs(back_xs.data()		+ first, ends, segment_runs[k], xs.data()	   + first);
+			expand_runs(back_ys.data()		+ first, ends, segment_runs[k], ys.data()	   + first);
+			expand_runs(back_thetas.data()	+ first, ends, segment_runs[k], thetas.data()  + first);
+			expand_runs(back_weights.data() + first, ends, segment_runs[k], weights.data() + first);
+		}
+	};
+	pool->parallel_for(segment_first.size(), 1, task);
+	compact = false;
 }
-Particle ParticleFilter::get_best_particle()
+void ParticleFilter::migrate()
 {
-	double highest_weight = -1.0;
-	Particle best_particle;
+	// Each island sends its best m particles to the next one in the ring, replacing the worst m there;
+	// with the alias resampler the m emigrants are drawn by weight from the island's table instead.
+	// Emigrants are never among the worst m of their own island, so they are copied straight into
+	// their destination slots without being overwritten first or travelling two islands
+	const unsigned int smallest = num_particles / island.size();
+	const unsigned int m		= std::min(smallest / 2, std::max(1u, static_cast<unsigned int>(migration_rate * smallest + 0.5)));
+
+	if (m == 0)
+		return;
+
+	migrants.resize(island.size() * m);
+
+	for (unsigned int k = 0; k < island.size(); ++k)
+	{
+		Island &is = island[k];
+
+		is.order.resize(is.end - is.begin);
+		std::iota(is.order.begin(), is.order.end(), is.begin);
+
+		auto heavier = [this](const unsigned int &a, const unsigned int &b) { return weights[a] > weights[b]; };
+
+		if (resampler == RESAMPLER_ALIAS)
+		{
+			// Only the worst m have to be in place; they are replaced anyway, so their weights are dropped from the draw
+			std::nth_element(is.order.begin(), is.order.end() - m, is.order.end(), heavier);
+
+			for (unsigned int j = is.order.size() - m; j < is.order.size(); ++j)
+				weights[is.order[j]] = 0.0;
+
+			if (is.table.build(weights.data() + is.begin, is.end - is.begin))
+			{
+				for (unsigned int j = 0; j < m; ++j)
+					migrants[k * m + j] = is.begin + is.table.draw(is.gen);
+				continue;
+			}
+		}
+		else
+			std::sort(is.order.begin(), is.order.end(), heavier);
+
+		for (unsigned int j = 0; j < m; ++j)
+			migrants[k * m + j] = is.order[j];
+	}
 
-	for (unsigned int i = 0; i < num_particles; ++i)
+	for (unsigned int k = 0; k < island.size(); ++k)
 	{
-		if (particles[i].weight > highest_weight)
+		const Island &to = island[(k + 1) % island.size()];
+
+		for (unsigned int j = 0; j < m; ++j)
 		{
-			highest_weight = particles[i].weight;
-			best_particle = particles[i];
+			const unsigned int i	= to.order[to.order.size() - 1 - j];
+			const unsigned int from = migrants[k * m + j];
+
+			ids[i]	   = ids[from];
+			xs[i]	   = xs[from];
+			ys[i]	   = ys[from];
+			thetas[i]  = thetas[from];
+			weights[i] = weights[from];
 		}
 	}
-	return best_particle;
 }
-bool ParticleFilter::initialized() const
+namespace
 {
-	return is_initialized;
+	struct BestParticleTask
+	{
+		const scalar_t				*xs;
+		const scalar_t				*ys;
+		const scalar_t				*thetas;
+		const double				*weights;
+		std::vector<PoseMoments>	&partials;
+		const bool					moments;
+		const double				reference_x;		// Moments are taken about a particle, sums of raw map coordinates
+		const double				reference_y;		// squared lose the covariance far from the map origin
+		const double				reference;
+
+		void operator()(unsigned int chunk, unsigned int begin, unsigned int end) const
+		{
+			PoseMoments m;
+
+			for (unsigned int i = begin; i < end; ++i)
+			{
+				if (weights[i] > m.best_weight)
+				{
+					m.best_weight	= weights[i];
+					m.best			= i;
+				}
+			}
+			if (moments)
+			{
+				for (unsigned int i = begin; i < end; ++i)
+				{
+					const double w = weights[i];
+					const double x = xs[i] - reference_x;
+					const double y = ys[i] - reference_y;
+					const double d = std::remainder(thetas[i] - reference, 2.0 * PI);
+
+					m.w  += w;
+					m.x  += w * x;
+					m.y  += w * y;
+					m.s  += w * std::sin(thetas[i]);
+					m.c  += w * std::cos(thetas[i]);
+					m.d  += w * d;
+					m.xx += w * x * x;
+					m.yy += w * y * y;
+					m.dd += w * d * d;
+					m.xy += w * x * y;
+					m.xd += w * x * d;
+					m.yd += w * y * d;
+				}
+			}
+			partials[chunk] = m;
+		}
+	};
 }
-void ParticleFilter::dataAssociation(const std::vector<LandmarkObs> &predicted, std::vector<LandmarkObs>& observations) 
+void ParticleFilter::sort_particles()
 {
-	double 		 m_dist 			= 0.0;
-	int 		 closest_landmark 	= 0;
-	double 		 min_dist  			= 0.0;
-	for (unsigned int i = 0; i < observations.size(); ++i)
+	if (island.empty())
+	{
+		sort_range(0, num_particles, pool, sort_histograms);
+
+		auto gather = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+		{
+			gather_range(0, begin, end);
+		};
+		pool->parallel_for(num_particles, PARTICLE_GRAIN, gather);
+	}
+	else
 	{
-		min_dist 		 = 99999;
-		closest_landmark = -1;
-		for (unsigned int j = 0; j < predicted.size(); ++j) 
+		// Islands keep their particles, each one is sorted on its own thread
+		auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
 		{
-			m_dist = dist(observations[i].x,observations[i].y, predicted[j].x, predicted[j].y);
-			if (m_dist < min_dist)
+			for (unsigned int k = begin; k < end; ++k)
 			{
-				min_dist = m_dist;
-				closest_landmark = predicted[j].id;
+				sort_range(island[k].begin, island[k].end, nullptr, island[k].histograms);
+				gather_range(island[k].begin, island[k].begin, island[k].end);
 			}
+		};
+		pool->parallel_for(island.size(), 1, task);
+	}
+
+	ids.swap(back_ids);
+	xs.swap(back_xs);
+	ys.swap(back_ys);
+	thetas.swap(back_thetas);
+	weights.swap(back_weights);
+}
+void ParticleFilter::sort_range(const unsigned int &begin, const unsigned int &end, ThreadPool *keys_pool, std::vector<unsigned int> &histograms)
+{
+	const unsigned int n = end - begin;
+	if (n == 0)
+		return;
+
+	// Keys over the bounding box of the particles themselves, so a converged cloud still spreads over the whole curve
+	const auto range_x = std::minmax_element(xs.begin() + begin, xs.begin() + end);
+	const auto range_y = std::minmax_element(ys.begin() + begin, ys.begin() + end);
+
+	const hilbert::Grid grid(*range_x.first, *range_y.first, *range_x.second, *range_y.second);
+
+	auto keys = [&](unsigned int chunk, unsigned int first, unsigned int last)
+	{
+		for (unsigned int i = begin + first; i < begin + last; ++i)
+			sort_keys[i] = grid.key(xs[i], ys[i]) >> (32 - SORT_BITS);
+	};
+	if (keys_pool)
+		keys_pool->parallel_for(n, PARTICLE_GRAIN, keys);
+	else
+		keys(0, 0, n);
+
+	hilbert::sort(sort_keys.data() + begin, indices.data() + begin, sort_keys_tmp.data() + begin, sort_order_tmp.data() + begin, n, SORT_BITS, keys_pool, histograms);
+}
+void ParticleFilter::set_threads(const unsigned int &threads_numb)
+{
+	own_pool.start(threads_numb);
+	pool = &own_pool;
+}
+void ParticleFilter::set_pool(ThreadPool *shared)
+{
+	pool = shared;
+}
+void ParticleFilter::set_numa(const bool &enabled)
+{
+	numa_enabled = enabled;
+
+	const std::vector<std::vector<unsigned int>> nodes = numa::node_cpus();
+	if (!enabled || nodes.empty())
+		return;
+
+	// Thread 0 is the calling thread, it runs chunk 0 of every loop
+	for (unsigned int t = 0; t < pool->size(); ++t)
+		pool->pin(t, nodes[static_cast<unsigned long>(t) * nodes.size() / pool->size()]);
+}
+void ParticleFilter::first_touch(const unsigned int &from)
+{
+	auto touch = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		begin = std::max(begin, from);
+		if (begin >= end)
+			return;
+
+		const size_t n = end - begin;
+		std::memset(ids.data()		   + begin, 0, n * sizeof(int));
+		std::memset(back_ids.data()	   + begin, 0, n * sizeof(int));
+		std::memset(indices.data()	   + begin, 0, n * sizeof(unsigned int));
+		std::memset(sort_keys.data()	   + begin, 0, n * sizeof(uint32_t));
+		std::memset(sort_keys_tmp.data()  + begin, 0, n * sizeof(uint32_t));
+		std::memset(sort_order_tmp.data() + begin, 0, n * sizeof(unsigned int));
+		std::memset(run_end.data()		   + begin, 0, n * sizeof(unsigned int));
+		std::memset(weights.data()	   + begin, 0, n * sizeof(double));
+		std::memset(back_weights.data() + begin, 0, n * sizeof(double));
+
+		scalar_t *arrays[] = { xs.data(), ys.data(), thetas.data(), back_xs.data(), back_ys.data(), back_thetas.data(), noise_x.data(), noise_y.data(), noise_theta.data() };
+		for (unsigned int a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a)
+			std::memset(arrays[a] + begin, 0, n * sizeof(scalar_t));
+	};
+	pool->parallel_for(num_particles, PARTICLE_GRAIN, touch);
+}
+unsigned int ParticleFilter::get_best_particle(PoseEstimate *estimate)
+{
+	if (num_particles == 0)
+		return 0;
+
+	expand();
+
+	partials.resize(pool->size());
+
+	BestParticleTask task = { xs.data(), ys.data(), thetas.data(), weights.data(), partials, estimate != nullptr, xs[0], ys[0], thetas[0] };
+	const unsigned int chunks = pool->parallel_for(num_particles, PARTICLE_GRAIN, task);
+
+	PoseMoments total;
+	for (unsigned int i = 0; i < chunks; ++i)
+	{
+		const PoseMoments &m = partials[i];
+		if (m.best_weight > total.best_weight)
+		{
+			total.best_weight	= m.best_weight;
+			total.best			= m.best;
 		}
-		observations[i].id = closest_landmark;
+		total.w  += m.w;  total.x  += m.x;  total.y  += m.y;
+		total.s  += m.s;  total.c  += m.c;  total.d  += m.d;
+		total.xx += m.xx; total.yy += m.yy; total.dd += m.dd;
+		total.xy += m.xy; total.xd += m.xd; total.yd += m.yd;
+	}
+
+	if (estimate)
+	{
+		*estimate = PoseEstimate();
+
+		if (total.w <= 0.0)
+		{
+			estimate->x		= xs[total.best];
+			estimate->y		= ys[total.best];
+			estimate->theta = thetas[total.best];
+		}
+		else
+		{
+			const double mx = total.x / total.w;
+			const double my = total.y / total.w;
+			const double md = total.d / total.w;
+
+			estimate->x		= xs[0] + mx;
+			estimate->y		= ys[0] + my;
+			estimate->theta = std::atan2(total.s, total.c);
+
+			estimate->cov[0] = total.xx / total.w - mx * mx;
+			estimate->cov[4] = total.yy / total.w - my * my;
+			estimate->cov[8] = total.dd / total.w - md * md;
+			estimate->cov[1] = estimate->cov[3] = total.xy / total.w - mx * my;
+			estimate->cov[2] = estimate->cov[6] = total.xd / total.w - mx * md;
+			estimate->cov[5] = estimate->cov[7] = total.yd / total.w - my * md;
+		}
+	}
+	return total.best;
+}
+void ParticleFilter::set_association(const AssociationType &type)
+{
+	association.reset(make_association_engine(type));
+	++map_generation;
+}
+void ParticleFilter::set_association(const std::shared_ptr<AssociationEngine> &engine)
+{
+	association = engine;
+	++map_generation;
+}
+const char* ParticleFilter::association_name() const
+{
+	return association->name();
+}
+void ParticleFilter::set_kernels(const CpuLevel &level)
+{
+	kernels = &get_kernels(level);
+}
+const char* ParticleFilter::kernels_name() const
+{
+	return kernels->name;
+}
+void ParticleFilter::set_resampler(const ResamplerType &type, const unsigned int &iterations)
+{
+	resampler			 = type;
+	resampler_iterations = iterations;
+}
+const char* ParticleFilter::resampler_name() const
+{
+	return ::resampler_name(resampler);
+}
+void ParticleFilter::set_sort_interval(const unsigned int &interval)
+{
+	sort_interval = interval;
+}
+void ParticleFilter::set_bucket_size(const double &size)
+{
+	bucket_size = size;
+}
+void ParticleFilter::set_landmark_cache(const double &margin)
+{
+	cache_margin = margin;
+}
+double ParticleFilter::landmark_cache_hit_rate() const
+{
+	unsigned long updates = 0, hits = 0;
+
+	for (unsigned int c = 0; c < chunk_scratch.size(); ++c)
+	{
+		updates += chunk_scratch[c].cache_updates;
+		hits	+= chunk_scratch[c].cache_hits;
 	}
+	for (unsigned int k = 0; k < island.size(); ++k)
+	{
+		updates += island[k].scratch.cache_updates;
+		hits	+= island[k].scratch.cache_hits;
+	}
+	return updates ? static_cast<double>(hits) / updates : 0.0;
+}
+void ParticleFilter::set_multiplicity(const bool &enabled)
+{
+	expand();
+	multiplicity = enabled;
 }
-std::string ParticleFilter::getAssociations(const Particle &best)
+void ParticleFilter::set_islands(const unsigned int &numb, const unsigned int &interval, const double &rate)
 {
-	std::stringstream ss;
-    std::copy(best.associations.begin(), best.associations.end(), std::ostream_iterator<int>(ss, " "));
-	std:: string s = ss.str();
-    s = s.substr(0, s.length()-1);  
-    return s;
+	islands_numb	   = numb;
+	migration_interval = interval;
+	migration_rate	   = rate;
 }
-Particle ParticleFilter::SetAssociations(Particle &particle,const std::vector<int> &associations,const std::vector<double> &sense_x,const std::vector<double> &sense_y)
+unsigned int ParticleFilter::islands() const
 {
-	particle.associations.clear();
-	particle.sense_x.clear();
-	particle.sense_y.clear();
+	return island.empty() ? 1 : island.size();
+}
+Particle ParticleFilter::particle(const unsigned int &i) const
+{
+	unsigned int j = i;
+
+	// In a compact set, the unique particle of the run holding i
+	if (compact)
+	{
+		const unsigned int k	 = std::upper_bound(segment_first.begin(), segment_first.end(), i) - segment_first.begin() - 1;
+		const unsigned int first = segment_first[k];
+		const unsigned int *ends = run_end.data() + first;
+
+		j = first + (std::upper_bound(ends, ends + segment_runs[k], i - first) - ends);
+	}
 
-	particle.associations	= associations;
- 	particle.sense_x	 	= sense_x;
- 	particle.sense_y 		= sense_y;
+	const ParticleArray<int>	  &id	  = compact ? back_ids		: ids;
+	const ParticleArray<scalar_t> &x	  = compact ? back_xs		: xs;
+	const ParticleArray<scalar_t> &y	  = compact ? back_ys		: ys;
+	const ParticleArray<scalar_t> &theta  = compact ? back_thetas	: thetas;
+	const ParticleArray<double>	  &weight = compact ? back_weights	: weights;
 
- 	return particle;
+	Particle p;
+	p.id	 = id[j];
+	p.x		 = x[j];
+	p.y		 = y[j];
+	p.theta	 = theta[j];
+	p.weight = weight[j];
+	return p;
 }
-std::string ParticleFilter::getSenseX(const Particle &best)
+unsigned int ParticleFilter::size() const
 {
-	std::stringstream ss;
-    std::copy( best.sense_x.begin(), best.sense_x.end(),  std::ostream_iterator<double>(ss, " "));
-    std::string s = ss.str();
-    s = s.substr(0, s.length()-1);  
-    return s;
+	return num_particles;
 }
-std::string ParticleFilter::getSenseY(const Particle &best)
+double ParticleFilter::total_weight() const
 {
-	std::stringstream ss;
-    std::copy( best.sense_y.begin(), best.sense_y.end(),  std::ostream_iterator<double>(ss, " "));
-    std::string s = ss.str();
-    s = s.substr(0, s.length()-1);  
-    return s;
+	if (!compact)
+		return std::accumulate(weights.begin(), weights.begin() + num_particles, 0.0);
+
+	// Copy by copy, in the order of the expanded set, so the sum is the same
+	double sum = 0.0;
+	for (unsigned int k = 0; k < segment_first.size(); ++k)
+	{
+		const unsigned int first = segment_first[k];
+
+		for (unsigned int r = 0, i = 0; r < segment_runs[k]; ++r)
+			for (; i < run_end[first + r]; ++i)
+				sum += back_weights[first + r];
+	}
+	return sum;
 }
-Particle & Particle::operator=(const Particle & particle)
+void ParticleFilter::save_state(FilterState &state) const
 {
-	this->associations	= particle.associations;
-	this->sense_x		= particle.sense_x;
-	this->sense_y		= particle.sense_y;
-	this->id			= particle.id;
-	this->x				= particle.x;
-	this->y				= particle.y;
-	this->theta			= particle.theta;
-	this->weight		= particle.weight;
+	// assign() reuses the capacity of the destination, so periodic checkpoints do not allocate
+	state.particles_numb = num_particles;
+	state.initialized	 = is_initialized;
+	state.gen			 = gen;
+	state.resamples		 = resamples;
+
+	state.island_gens.resize(island.size());
+	for (unsigned int k = 0; k < island.size(); ++k)
+		state.island_gens[k] = island[k].gen;
+
+	if (compact)
+	{
+		state.ids.resize(num_particles);
+		state.xs.resize(num_particles);
+		state.ys.resize(num_particles);
+		state.thetas.resize(num_particles);
+		state.weights.resize(num_particles);
 
-	return *this;
+		// The checkpoint holds the expanded set; prediction treats it as runs of one, with the same result
+		for (unsigned int k = 0; k < segment_first.size(); ++k)
+		{
+			const unsigned int first = segment_first[k];
+			const unsigned int *ends = run_end.data() + first;
+
+			expand_runs(back_ids.data()		+ first, ends, segment_runs[k], state.ids.data()	 + first);
+			expand_runs(back_xs.data()		+ first, ends, segment_runs[k], state.xs.data()		 + first);
+			expand_runs(back_ys.data()		+ first, ends, segment_runs[k], state.ys.data()		 + first);
+			expand_runs(back_thetas.data()	+ first, ends, segment_runs[k], state.thetas.data()	 + first);
+			expand_runs(back_weights.data() + first, ends, segment_runs[k], state.weights.data() + first);
+		}
+		return;
+	}
+
+	state.ids.assign	(ids.begin(),	  ids.begin()	  + num_particles);
+	state.xs.assign		(xs.begin(),	  xs.begin()	  + num_particles);
+	state.ys.assign		(ys.begin(),	  ys.begin()	  + num_particles);
+	state.thetas.assign	(thetas.begin(),  thetas.begin()  + num_particles);
+	state.weights.assign(weights.begin(), weights.begin() + num_particles);
 }
-Particle::Particle(const Particle & particle)
+void ParticleFilter::restore_state(const FilterState &state)
 {
-	this->associations 	= particle.associations;
-	this->sense_x 		= particle.sense_x;
-	this->sense_y 		= particle.sense_y;
-	this->id 			= particle.id;
-	this->x 			= particle.x;
-	this->y 			= particle.y;
-	this->theta 		= particle.theta;
-	this->weight 		= particle.weight;
-}
\ No newline at end of file
+	allocate(state.particles_numb);
+
+	is_initialized = state.initialized;
+	gen			   = state.gen;
+	resamples	   = state.resamples;
+
+	// A checkpoint taken with another island count reseeds the islands as init() does
+	for (unsigned int k = 0; k < island.size(); ++k)
+		island[k].gen = state.island_gens.size() == island.size() ? state.island_gens[k] : std::mt19937(gen());
+
+	std::copy(state.ids.begin(),	 state.ids.begin()	   + num_particles, ids.begin());
+	std::copy(state.xs.begin(),		 state.xs.begin()	   + num_particles, xs.begin());
+	std::copy(state.ys.begin(),		 state.ys.begin()	   + num_particles, ys.begin());
+	std::copy(state.thetas.begin(),	 state.thetas.begin()  + num_particles, thetas.begin());
+	std::copy(state.weights.begin(), state.weights.begin() + num_particles, weights.begin());
+}
+bool ParticleFilter::initialized() const
+{
+	return is_initialized;
+}
+void ParticleFilter::associate(const Particle &particle, const double &sensor_range, const std::vector<LandmarkObs> &observations, const Map &map_landmarks)
+{
+	transform_obs.resize(observations.size());
+
+	for (unsigned int j = 0; j < observations.size(); ++j)
+	{
+		const scalar_t trans_obs_x = observations[j].x * std::cos(particle.theta) - observations[j].y * std::sin(particle.theta) + particle.x;
+		const scalar_t trans_obs_y = observations[j].x * std::sin(particle.theta) + observations[j].y * std::cos(particle.theta) + particle.y;
+
+		transform_obs[j] = LandmarkObs(trans_obs_x, trans_obs_y, -1);
+	}
+
+	ensure_engine(map_landmarks);
+
+	// Candidates are the landmarks in range of the particle, the same ones its weight was computed from
+	associate_land.clear();
+	association->in_range(particle.x, particle.y, sensor_range, associate_land);
+
+	for (unsigned int j = 0; j < transform_obs.size(); ++j)
+	{
+		scalar_t min_d2 = std::numeric_limits<scalar_t>::max();
+
+		for (unsigned int k = 0; k < associate_land.size(); ++k)
+		{
+			const scalar_t d2 = dist2(transform_obs[j].x, transform_obs[j].y, associate_land.x[k], associate_land.y[k]);
+			if (d2 < min_d2)
+			{
+				min_d2				= d2;
+				transform_obs[j].id = associate_land.id[k];
+			}
+		}
+	}
+
+	associations.clear();
+	sense_x.clear();
+	sense_y.clear();
+
+	for (unsigned int j = 0; j < transform_obs.size(); ++j)
+	{
+		if (transform_obs[j].id == -1)
+			continue;
+
+		associations.push_back(transform_obs[j].id);
+		sense_x.push_back(map_landmarks.to_global_x(transform_obs[j].x));
+		sense_y.push_back(map_landmarks.to_global_y(transform_obs[j].y));
+	}
+}
+template<typename Type>
+static std::string join(const std::vector<Type> &values, const char *format)
+{
+	std::string s;
+	char buff[32];
+
+	for (unsigned int i = 0; i < values.size(); ++i)
+	{
+		const int len = std::snprintf(buff, sizeof(buff), format, values[i]);
+		if (i != 0)
+			s += ' ';
+		s.append(buff, len);
+	}
+	return s;
+}
+std::string ParticleFilter::getAssociations() const
+{
+	return join(associations, "%d");
+}
+std::string ParticleFilter::getSenseX() const
+{
+	return join(sense_x, "%.9g");
+}
+std::string ParticleFilter::getSenseY() const
+{
+	return join(sense_y, "%.9g");
+}
@@ -3,38 +3,90 @@
 
 #include "libs.h"
 #include "helper_functions.h"
+#include "thread_pool.h"
+#include "association.h"
+#include "kernels.h"
+#include "numa.h"
+#include "resampling.h"
+#include "hilbert.h"
+
+// Per-particle arrays; growing one leaves the new elements for their owning threads to touch first
+template<typename T>
+using ParticleArray = std::vector<T, numa::Allocator<T>>;
 
 struct Particle 
 {
 	Particle() : id(0), x(0.0), y(0.0), theta(0.0), weight(0.0) {}
-	Particle& operator=(const Particle& particle);
-	Particle(const Particle& particle);
 
 	int							id;
-	double						x;
-	double						y;
-	double						theta;
+	scalar_t					x;			// Position relative to the map origin [m]
+	scalar_t					y;
+	scalar_t					theta;
 	double						weight;
+};
+/*
+ * Weighted moments of the particle set, computed in the same pass as the best particle.
+ */
+struct PoseEstimate
+{
+	PoseEstimate() : x(0.0), y(0.0), theta(0.0)
+	{
+		for (unsigned int i = 0; i < 9; ++i)
+			cov[i] = 0.0;
+	}
 
-	std::vector<int>			associations;
-	std::vector<double>			sense_x;
-	std::vector<double>			sense_y;
+	double						x;			// Weighted mean x, relative to the map origin [m]
+	double						y;			// Weighted mean y, relative to the map origin [m]
+	double						theta;		// Weighted circular mean yaw [rad]
+	double						cov[9];		// Row-major 3x3 covariance of (x, y, theta)
 };
+/*
+ * Per-chunk partial sums of get_best_particle(). Theta enters as a residual to a
+ * reference angle so the covariance does not break at the +-PI wrap.
+ */
+struct PoseMoments
+{
+	PoseMoments() : best(0), best_weight(-1.0), w(0.0), x(0.0), y(0.0), s(0.0), c(0.0), d(0.0), xx(0.0), yy(0.0), dd(0.0), xy(0.0), xd(0.0), yd(0.0) {}
+
+	unsigned int				best;
+	double						best_weight;
+	double						w, x, y, s, c, d, xx, yy, dd, xy, xd, yd;
+};
+
+/*
+ * Everything a frame's outcome depends on besides its inputs: the particles and the
+ * generator. Saved and restored to replay a window of frames exactly.
+ */
+struct FilterState
+{
+	FilterState() : particles_numb(0), initialized(false), resamples(0) {}
 
+	unsigned int				particles_numb;
+	bool						initialized;
+	std::mt19937				gen;
+	std::vector<std::mt19937>	island_gens;		// Empty with one global particle set
+	unsigned long				resamples;			// Drives the island migration interval
+
+	std::vector<int>			ids;
+	std::vector<scalar_t>		xs;
+	std::vector<scalar_t>		ys;
+	std::vector<scalar_t>		thetas;
+	std::vector<double>			weights;
+};
 
 class ParticleFilter
 {
 public:
 	// Constructor
 	// @param M Number of particles
-	ParticleFilter() : num_particles(0), is_initialized(false) {}
+	ParticleFilter() : num_particles(0), is_initialized(false), gen(rd()), pool(&own_pool), numa_enabled(false), resampler(RESAMPLER_SYSTEMATIC), resampler_iterations(0), sort_interval(0), bucket_size(0.0), cache_margin(0.0), map_generation(0), multiplicity(false), compact(false), islands_numb(1), migration_interval(0), migration_rate(0.0), resamples(0), association(make_association_engine(ASSOCIATION_BRUTE_FORCE)), kernels(&get_kernels(detect_cpu_level())) {}
 
 	// Destructor
 	~ParticleFilter() {}
 	/**
 	 * init Initializes particle filter by initializing particles to Gaussian
 	 *   distribution around first position and all the weights to 1.
-	 * @param x Initial x position [m] (simulated estimate from GPS)
+	 * @param x Initial x position [m] (simulated estimate from GPS, relative to the map origin)
 	 * @param y Initial y position [m]
 	 * @param theta Initial orientation [rad]
 	 * @param std[] Array of dimension 3 [standard deviation of x [m], standard deviation of y [m]
@@ -61,50 +113,328 @@ public:
 	 * @param map Map class containing map landmarks
 	 */
 	void updateWeights(const double &sensor_range,const std::vector<double> &std_landmark, const std::vector<LandmarkObs> &observations,const Map &map_landmarks);
+	/**
+	 * updateWeights Same as above, reading the observations straight from caller owned arrays.
+	 * @param observations_x, observations_y Arrays of n_obs observations in vehicle coordinates
+	 */
+	void updateWeights(const double &sensor_range,const std::vector<double> &std_landmark, const scalar_t *observations_x, const scalar_t *observations_y, const unsigned int &n_obs, const Map &map_landmarks);
 	/**
 	 * resample Resamples from the updated set of particles to form
-	 *   the new set of particles.
+	 *   the new set of particles. Ancestors are drawn as indices and gathered field by field
+	 *   into preallocated back arrays that are swapped in, so it neither allocates nor copies
+	 *   Particle structs.
 	 */
 	void resample();
 	/**
-	 * dataAssociation Finds which observations correspond to which landmarks (likely by using
-	 *   a nearest-neighbors data association).
-	 * @param predicted Vector of predicted landmark observations
-	 * @param observations Vector of landmark observations
+	 * resample Resamples to a different number of particles. Shards of a distributed filter
+	 *   use it to follow their share of the total weight.
 	 */
-	void dataAssociation(const std::vector<LandmarkObs> &predicted, std::vector<LandmarkObs>& observations);
-	/*
-	 * Set a particles list of associations, along with the associations calculated world x,y coordinates
-	 * This can be a very useful debugging tool to make sure transformations are correct and assocations correctly connected
+	void resample(const unsigned int &particles_numb);
+	/**
+	 * take_particles Removes count particles spread evenly over the set and appends them to out.
 	 */
-	Particle SetAssociations(Particle &particle,const std::vector<int>&associations,const std::vector<double> &sense_x,const std::vector<double> &sense_y);
+	void take_particles(const unsigned int &count, std::vector<Particle> &out);
+	/**
+	 * add_particles Appends count particles, e.g. ones taken from another shard.
+	 */
+	void add_particles(const Particle *particles, const unsigned int &count);
+	/**
+	 * associate Computes the landmark associations of a single (reported) particle, along with the
+	 *   observations transformed to world x,y coordinates. Only this particle pays for the bookkeeping.
+	 *   Every observation is matched with the nearest landmark in range of the particle, the ones its
+	 *   weight was computed from; with none in range it stays unassociated.
+	 * @param particle Particle to associate, usually the best one
+	 * @param sensor_range Range [m] of sensor
+	 * @param observations Vector of landmark observations
+	 * @param map Map class containing map landmarks
+	 */
+	void associate(const Particle &particle, const double &sensor_range, const std::vector<LandmarkObs> &observations, const Map &map_landmarks);
 	/**
 	 * initialized Returns whether particle filter is initialized yet or not.
 	 */
 	bool initialized() const;
-	
-	Particle 	get_best_particle();
-	
-	std::string getAssociations	(const Particle &best);
-	std::string getSenseX		(const Particle &best);
-	std::string getSenseY		(const Particle &best);
+	/**
+	 * set_association Selects the engine answering landmark range queries. It is (re)built
+	 *   from the map on the first updateWeights() call that passes a different map.
+	 */
+	void set_association(const AssociationType &type);
+	/**
+	 * set_association Uses an engine shared with other filters, already built for their common
+	 *   map, so vehicles on one map hold a single copy of it. The engine is never rebuilt through
+	 *   this filter: a different map gets the filter an engine of its own.
+	 */
+	void set_association(const std::shared_ptr<AssociationEngine> &engine);
 
+	const char* association_name() const;
+	/**
+	 * set_threads Runs the filter on its own pool of threads_numb threads, 0 uses all hardware threads.
+	 */
+	void set_threads(const unsigned int &threads_numb);
+	/**
+	 * set_pool Runs the filter on a pool shared with other filters instead, e.g. one pool for every
+	 *   vehicle of a process. Loops of filters stepped from different threads take turns on it.
+	 */
+	void set_pool(ThreadPool *shared);
+	/**
+	 * set_numa Pins the pool threads to NUMA nodes, thread t of T to node t * nodes / T, so
+	 *   consecutive particle chunks (and islands, with ISLANDS a multiple of the threads) share
+	 *   a node. Particle arrays are then first-touched chunk by chunk by the threads that
+	 *   process them, and every particle loop uses the same chunks. Thread 0 is the calling
+	 *   thread, so call from the thread that steps the filter, after set_threads() or set_pool();
+	 *   hosts without /sys topology only get the first touch.
+	 */
+	void set_numa(const bool &enabled);
+	/**
+	 * set_kernels Overrides the kernel level picked from the host CPU at construction.
+	 */
+	void set_kernels(const CpuLevel &level);
+
+	const char* kernels_name() const;
+	/**
+	 * set_resampler Selects how resample() draws the ancestors: systematic (one uniform draw
+	 *   and a pass over the cumulative weights), independent O(1) draws from an alias table,
+	 *   which also picks the emigrants of island migration, or Metropolis / rejection sampling,
+	 *   which need no prefix sum, so every block of particles is resampled on its own thread.
+	 * @param iterations Metropolis steps per particle, or the rejection proposal cap (0 = none)
+	 */
+	void set_resampler(const ResamplerType &type, const unsigned int &iterations = 0);
+
+	const char* resampler_name() const;
+	/**
+	 * set_sort_interval Every interval resamples, reorders the particles (within each island)
+	 *   along the Hilbert curve of their positions, so particles that are weighed one after the
+	 *   other query the same landmarks, which Map also keeps in curve order. The keys are sorted
+	 *   with a parallel radix sort. 0 never sorts.
+	 */
+	void set_sort_interval(const unsigned int &interval);
+	/**
+	 * set_bucket_size Groups the particles of every weight update chunk into square grid cells
+	 *   of size [m] and runs one landmark range query per cell, widened by the cell size, instead
+	 *   of one per particle. Each particle then keeps the candidates within the sensor range
+	 *   with the engines' own distance test, so it sees the same landmarks. 0 queries per particle.
+	 */
+	void set_bucket_size(const double &size);
+	/**
+	 * set_landmark_cache Keeps the landmarks around every weight update chunk (or island) between
+	 *   frames. The chunk's particles are bounded by a circle; the cached query covers it widened
+	 *   by margin [m] and is reused until the particles leave it, which at 10 Hz takes several
+	 *   frames. Particle (and bucket) queries then filter the cached landmarks instead of asking
+	 *   the engine, with its own distance test. Chunks wider than the sensor range are not
+	 *   cached. 0 queries the engine every frame.
+	 */
+	void set_landmark_cache(const double &margin);
+	/**
+	 * landmark_cache_hit_rate Fraction of the chunk weight updates since the filter was created
+	 *   that reused their cached landmarks.
+	 */
+	double landmark_cache_hit_rate() const;
+	/**
+	 * set_multiplicity Keeps the resampled set as one particle per run of copies of the same
+	 *   ancestor, with the copy count, so resampling writes only the unique particles. The next
+	 *   prediction() moves every unique particle once and expands its copies with their own
+	 *   noise; anything else reading the particles before that expands them first. Pays off
+	 *   when weights are peaked and most particles are duplicates.
+	 */
+	void set_multiplicity(const bool &enabled);
+	/**
+	 * set_islands Splits the particle set into islands of contiguous particles. Each island
+	 *   predicts, weighs and resamples on its own on the thread pool, with its own generator,
+	 *   so no step synchronizes over all particles. Every interval frames the best rate
+	 *   fraction of each island replaces the worst particles of the next one (a ring).
+	 *   Takes effect at the next init(), 0 or 1 keeps one global particle set.
+	 */
+	void set_islands(const unsigned int &numb, const unsigned int &interval, const double &rate);
+
+	unsigned int islands() const;
+	/**
+	 * particle Returns a copy of the i-th particle.
+	 */
+	Particle particle(const unsigned int &i) const;
+
+	unsigned int size() const;
+
+	double total_weight() const;
+	/**
+	 * save_state Copies the particles and the generator state into state.
+	 */
+	void save_state(FilterState &state) const;
+	/**
+	 * restore_state Makes the filter continue exactly from a saved state.
+	 */
+	void restore_state(const FilterState &state);
+	/**
+	 * get_best_particle Parallel reduction over the particle set.
+	 * @param estimate Optional output for the weighted mean pose and covariance
+	 * @output Index of the particle with the highest weight
+	 */
+	unsigned int get_best_particle(PoseEstimate *estimate = nullptr);
 	
-	// Set of current particles
-	std::vector<Particle>	particles;
+	// Space separated results of the last associate() call
+	std::string getAssociations	() const;
+	std::string getSenseX		() const;
+	std::string getSenseY		() const;
+
 private:
+	// Per-thread buffers of the weight update
+	struct WeightScratch
+	{
+		WeightScratch() : cache_x(0.0), cache_y(0.0), cache_reach(0.0), cache_range(0.0), cache_generation(0), cache_updates(0), cache_hits(0) {}
+
+		std::vector<scalar_t>	trans_x;
+		std::vector<scalar_t>	trans_y;
+		std::vector<scalar_t>	min_d2;
+		std::vector<scalar_t>	expo;
+		LandmarkSet				closest_land;
+		LandmarkSet				bucket_land;	// Candidates of the current cell
+		std::vector<std::pair<uint64_t, unsigned int>> cells;	// Packed cell and particle, grouped by cell
+
+		// Landmarks within cache_reach of (cache_x, cache_y), kept across frames
+		LandmarkSet				cache_land;
+		double					cache_x;
+		double					cache_y;
+		double					cache_reach;
+		scalar_t				cache_range;	// Sensor range the reach was sized for
+		unsigned int			cache_generation;	// map_generation of the query, 0 is empty
+		unsigned long			cache_updates;
+		unsigned long			cache_hits;
+	};
+	// Frame constants of the weight update
+	struct WeightParams
+	{
+		const scalar_t			*obs_x;
+		const scalar_t			*obs_y;
+		unsigned int			n_obs;
+		scalar_t				range;
+		scalar_t				inv_2sx2;
+		scalar_t				inv_2sy2;
+		double					log_norm;		// Log of the bivariate normal's normalizer, its power overflows on dense maps
+	};
+	// Particles [begin, end) owned by one island
+	struct Island
+	{
+		unsigned int				begin;
+		unsigned int				end;
+		std::mt19937				gen;
+		WeightScratch				scratch;
+		std::vector<unsigned int>	order;		// Particles by weight, for migration
+		AliasTable					table;
+		std::vector<unsigned int>	histograms;	// Radix sort scratch
+	};
+
+	// Sizes the particle and scratch arrays
+	void allocate(const unsigned int &particles_numb);
+	// Builds the association engine for map_landmarks if needed, a rebuild invalidates the landmark caches
+	void ensure_engine	(const Map &map_landmarks);
+
+	void draw_noise		(const unsigned int &begin, const unsigned int &end, std::mt19937 &generator, const std::vector<double> &std_pos);
+	void weigh			(const unsigned int &begin, const unsigned int &end, const WeightParams &params, WeightScratch &scratch);
+	// Same as weigh(), with one range query per grid cell of bucket_size
+	void weigh_buckets	(const unsigned int &begin, const unsigned int &end, const WeightParams &params, WeightScratch &scratch, const LandmarkSet *cache);
+	// Requeries scratch.cache_land if [begin, end) has left it; false if the particles are too spread to cache
+	bool refresh_cache	(const unsigned int &begin, const unsigned int &end, const WeightParams &params, WeightScratch &scratch);
+	// Landmarks closer than range to (x, y) from the engine, or filtered out of cache when given
+	void in_range		(const scalar_t &x, const scalar_t &y, const scalar_t &range, const LandmarkSet *cache, LandmarkSet &out) const;
+	// Likelihood of particle i against the landmarks in scratch.closest_land
+	double likelihood	(const unsigned int &i, const WeightParams &params, WeightScratch &scratch);
+	// Resampling of [begin, end) into the back arrays, false if all weights are zero
+	bool resample_range	(const unsigned int &begin, const unsigned int &end, std::mt19937 &generator, AliasTable &table);
+	// Draws the ancestors of [begin, end) into indices, relative to begin; draw_pool is passed on to draw_ancestors()
+	bool pick			(const unsigned int &begin, const unsigned int &end, std::mt19937 &generator, AliasTable &table, ThreadPool *draw_pool = nullptr);
+	// Alias, Metropolis or rejection ancestors of count particles drawn from weights[0, n), false if all weights are zero;
+	// with draw_pool the draws run in parallel over fixed blocks, each with its own generator seeded from generator
+	bool draw_ancestors	(const double *w, const unsigned int &n, const unsigned int &count, std::mt19937 &generator, AliasTable &table,
+						 ThreadPool *draw_pool, unsigned int *ancestors);
+	// Copies the ancestors picked for [begin, end) into the back arrays, base is the begin passed to pick()
+	void gather_range	(const unsigned int &base, const unsigned int &begin, const unsigned int &end);
+	// Same, copying one particle per run of equal ancestors to begin, begin + 1, ...; returns the number of runs
+	unsigned int compact_range(const unsigned int &base, const unsigned int &begin, const unsigned int &end);
+	// Writes the runs of a compact set out into the particle arrays
+	void expand			();
+	// Writes elements [from, num_particles) of every particle array from the thread owning their chunk
+	void first_touch	(const unsigned int &from);
+	void migrate		();
+	// Moves the particles into curve order through the back arrays
+	void sort_particles	();
+	// Curve order of [begin, end) into indices, relative to begin; keys_pool computes the keys and sorts in parallel
+	void sort_range		(const unsigned int &begin, const unsigned int &end, ThreadPool *keys_pool, std::vector<unsigned int> &histograms);
+
 	// Number of particles to draw
 	unsigned int			num_particles;
 
 	// Flag, if filter is initialized
 	bool					is_initialized;
 
+	// Set of current particles, one array per field
+	ParticleArray<int>		ids;
+	ParticleArray<scalar_t>	xs;
+	ParticleArray<scalar_t>	ys;
+	ParticleArray<scalar_t>	thetas;
+
 	// Vector of weights of all particles
-	std::vector<double>		weights;
+	ParticleArray<double>	weights;
 	
 	std::random_device		rd;
 	std::mt19937	 		gen;
-	
-	typedef std::vector<Map::single_landmark_s> Landmark_list;
+
+	ThreadPool				own_pool;
+	ThreadPool				*pool;				// own_pool, or one shared with other filters
+	bool					numa_enabled;
+	ResamplerType			resampler;
+	unsigned int			resampler_iterations;
+	AliasTable				alias_table;		// Of the global particle set, islands have their own
+	std::vector<unsigned int> draw_seeds;		// Per block of ancestor draws, so the draws run in parallel
+	std::vector<double>		chunk_max;			// Per chunk maximum weight
+	unsigned int			sort_interval;
+	double					bucket_size;		// Grid cell of the shared landmark queries [m], 0 disables
+	double					cache_margin;		// Slack of the cached landmark queries [m], 0 disables
+	unsigned int			map_generation;		// Bumped whenever the engine is replaced or rebuilt, invalidates the caches
+	bool					multiplicity;
+
+	// Compact set: the unique particles of segment k (a particle chunk, or an island) are in the back
+	// arrays from segment_first[k] on, with the ends of their runs relative to segment_first[k] in run_end
+	bool					compact;
+	std::vector<unsigned int> segment_first;
+	std::vector<unsigned int> segment_runs;
+	ParticleArray<unsigned int> run_end;
+
+	unsigned int			islands_numb;
+	unsigned int			migration_interval;
+	double					migration_rate;
+	unsigned long			resamples;
+	std::vector<Island>		island;
+	std::vector<unsigned int> migrants;		// Source particle of every migration, island by island
+
+	std::shared_ptr<AssociationEngine> association;
+	const Kernels*			kernels;
+	std::vector<PoseMoments>	partials;
+
+	// Per-frame scratch memory, reused across frames instead of being reallocated
+	ParticleArray<int>		back_ids;
+	ParticleArray<scalar_t>	back_xs;
+	ParticleArray<scalar_t>	back_ys;
+	ParticleArray<scalar_t>	back_thetas;
+	ParticleArray<double>	back_weights;
+	ParticleArray<unsigned int> indices;
+	ParticleArray<uint32_t>	sort_keys;
+	ParticleArray<uint32_t>	sort_keys_tmp;
+	ParticleArray<unsigned int> sort_order_tmp;
+	std::vector<unsigned int> sort_histograms;
+
+	ParticleArray<scalar_t>	noise_x;
+	ParticleArray<scalar_t>	noise_y;
+	ParticleArray<scalar_t>	noise_theta;
+
+	std::vector<scalar_t>	obs_x;
+	std::vector<scalar_t>	obs_y;
+	WeightScratch			scratch;
+	std::vector<WeightScratch> chunk_scratch;	// One per pool thread for the global particle set
+
+	std::vector<LandmarkObs>	transform_obs;
+	LandmarkSet					associate_land;
+
+	// Associations of the particle passed to associate(), sense_x/sense_y in global coordinates
+	std::vector<int>			associations;
+	std::vector<double>			sense_x;
+	std::vector<double>			sense_y;
 };
 #endif /* PARTICLE_FILTER_H_ */
@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <malloc.h>
+#include "config.h"
+#include "json.hpp"
+#include "particle_filter.h"
+#include "session.h"
+
+/*
+ * Scaling benchmark. Sweeps particle count, run (one pf_generate directory per landmark
+ * density), observations per frame, thread count, island count, resampler, particle sort interval,
+ * landmark bucket size, landmark cache margin, multiplicity encoding and kernel level, runs the full
+ * per-frame pipeline of Session::step() over every combination and writes one row per configuration:
+ * frames/s, p50/p99 frame latency, mean resampling time, landmark cache hit rate, filter heap
+ * footprint and RMSE of the best particle against gt_data.txt, computed from getError(). Rows that no other configuration of the same run
+ * beats on both throughput and RMSE are marked as the accuracy-vs-throughput Pareto front, which
+ * is also printed.
+ * Usage: pf_bench run_dir[,run_dir...] [particles=100,1000] [obs=0,8] [threads=1,4] [islands=1,4]
+ *                 [resamplers=systematic,alias,metropolis,rejection] [sort=0,4] [bucket=0,2] [cache=0,2]
+ *                 [multiplicity=0,1] [kernels=generic,avx2|all] [frames=N] [cfg=file] [csv=file] [json=file]
+ * obs=0 keeps every observation, obs=k the k closest to the vehicle, sort=n sorts the particles
+ * along the Hilbert curve every n resamples (0 never), bucket=s shares one landmark query per
+ * s x s m cell (0 queries per particle), cache=m keeps each chunk's landmarks across frames until
+ * its particles move m metres (0 never), multiplicity=1 keeps resampled duplicates as copy
+ * counts. Filter settings not swept (sensor range, noise, association, resampler iterations, numa)
+ * come from the cfg file.
+ */
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Run
+	{
+		std::string							dir;
+		Map									map;
+		double								density;		// Landmarks per hectare
+		std::vector<control_s>				control;
+		std::vector<ground_truth>			gt;
+		std::vector<std::vector<LandmarkObs>> observations;	// Sorted by range
+	};
+
+	struct Result
+	{
+		Result() : run(0), particles(0), obs(0), threads(0), islands(0), resampler(RESAMPLER_SYSTEMATIC), sort_interval(0), bucket_size(0.0), cache_margin(0.0), multiplicity(false), level(CPU_GENERIC), frames(0), fps(0.0), p50_us(0.0),
+				   p99_us(0.0), resample_us(0.0), cache_hit(0.0), heap_bytes(0), rmse_xy(0.0), rmse_theta(0.0), pareto(false) {}
+
+		unsigned int				run;
+		unsigned int				particles;
+		unsigned int				obs;
+		unsigned int				threads;
+		unsigned int				islands;
+		ResamplerType				resampler;
+		unsigned int				sort_interval;
+		double						bucket_size;
+		double						cache_margin;
+		bool						multiplicity;
+		CpuLevel					level;
+		unsigned int				frames;
+		double						fps;
+		double						p50_us;
+		double						p99_us;
+		double						resample_us;		// Mean of the resampling step alone
+		double						cache_hit;			// Landmark cache hit rate
+		long						heap_bytes;			// Heap held by the filter after the run
+		double						rmse_xy;			// [m]
+		double						rmse_theta;			// [rad]
+		bool						pareto;
+	};
+
+	std::vector<std::string> split(const std::string &str)
+	{
+		std::vector<std::string> items;
+		std::istringstream		 iss(str);
+		std::string				 item;
+
+		while (std::getline(iss, item, ','))
+			if (!item.empty())
+				items.push_back(item);
+		return items;
+	}
+	std::vector<unsigned int> split_numbers(const std::string &str)
+	{
+		std::vector<unsigned int>	   numbers;
+		const std::vector<std::string> items = split(str);
+
+		for (unsigned int i = 0; i < items.size(); ++i)
+			numbers.push_back(std::strtoul(items[i].c_str(), nullptr, 10));
+		return numbers;
+	}
+	double percentile(const std::vector<double> &sorted, const double &p)
+	{
+		return sorted.empty() ? 0.0 : sorted[std::min<size_t>(sorted.size() - 1, size_t(p * sorted.size()))];
+	}
+	// Heap bytes in use, from the allocation counters when they are built in
+	long heap_in_use()
+	{
+		if (alloc_stats::enabled)
+		{
+			alloc_stats::Snapshot snapshot;
+			alloc_stats::snapshot(snapshot);
+			return snapshot.live_bytes;
+		}
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+		return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+		return mallinfo().uordblks;
+#else
+		return 0;
+#endif
+	}
+	bool load_run(const std::string &dir, const unsigned int &frames_numb, Run &run)
+	{
+		run.dir = dir;
+
+		if (!read_map_data(dir + "/map_data.txt", run.map) || !read_control_data(dir + "/control_data.txt", run.control) || !read_gt_data(dir + "/gt_data.txt", run.gt))
+			return false;
+
+		for (unsigned int f = 0; f < run.gt.size() && f < run.control.size() && f < frames_numb; ++f)
+		{
+			char path[64];
+			snprintf(path, sizeof(path), "/observation/observations_%06u.txt", f + 1);
+
+			std::vector<LandmarkObs> observations;
+			if (!read_landmark_data(dir + path, observations))
+				break;
+
+			std::sort(observations.begin(), observations.end(), [](const LandmarkObs &a, const LandmarkObs &b)
+			{
+				return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y;
+			});
+			run.observations.push_back(observations);
+		}
+
+		// Map extent from the landmark bounding box, one hectare is 10^4 m^2
+		scalar_t min_x = 0, max_x = 0, min_y = 0, max_y = 0;
+		const std::vector<Map::single_landmark_s> &landmarks = run.map.landmark_list;
+		for (unsigned int i = 0; i < landmarks.size(); ++i)
+		{
+			min_x = i ? std::min(min_x, landmarks[i].x_f) : landmarks[i].x_f;
+			max_x = i ? std::max(max_x, landmarks[i].x_f) : landmarks[i].x_f;
+			min_y = i ? std::min(min_y, landmarks[i].y_f) : landmarks[i].y_f;
+			max_y = i ? std::max(max_y, landmarks[i].y_f) : landmarks[i].y_f;
+		}
+		const double area_ha = std::max(1.0, double(max_x - min_x) * double(max_y - min_y) * 1e-4);
+		run.density = landmarks.size() / area_ha;
+
+		return !run.observations.empty();
+	}
+	// One pass over the run with a fresh filter, the same stages Session::step() runs per frame
+	void bench(const Run &run, const FilterConfig &base_cfg, Result &result)
+	{
+		// The swept settings over the cfg file, applied the way a Session applies them
+		FilterConfig cfg = base_cfg;
+		cfg.threads_numb  = result.threads;
+		cfg.islands_numb  = result.islands;
+		cfg.resampler	  = result.resampler;
+		cfg.sort_interval = result.sort_interval;
+		cfg.bucket_size	  = result.bucket_size;
+		cfg.cache_margin  = result.cache_margin;
+		cfg.multiplicity  = result.multiplicity;
+
+		std::mt19937					 gen(7);
+		std::normal_distribution<double> gps_x(0.0, cfg.sigma_pos[0]), gps_y(0.0, cfg.sigma_pos[1]), gps_theta(0.0, cfg.sigma_pos[2]);
+
+		const unsigned int frames_numb = run.observations.size();
+
+		// Observations capped outside the timed loop
+		std::vector<std::vector<LandmarkObs>> observations(frames_numb);
+		for (unsigned int f = 0; f < frames_numb; ++f)
+		{
+			const std::vector<LandmarkObs> &all = run.observations[f];
+			observations[f].assign(all.begin(), all.begin() + (result.obs ? std::min<size_t>(result.obs, all.size()) : all.size()));
+		}
+
+		std::vector<double> frame_us;
+		frame_us.reserve(frames_numb);
+		double				resample_us = 0.0;
+
+		double		sq_xy = 0.0, sq_theta = 0.0;
+		const long	heap_before = heap_in_use();
+		{
+			std::unique_ptr<ParticleFilter> pf(new ParticleFilter());
+			configure(*pf, cfg);
+			pf->set_kernels(result.level);
+
+			for (unsigned int f = 0; f < frames_numb; ++f)
+			{
+				const Clock::time_point start = Clock::now();
+
+				if (!pf->initialized())
+					pf->init(result.particles, run.map.to_local_x(run.gt[f].x + gps_x(gen)), run.map.to_local_y(run.gt[f].y + gps_y(gen)), run.gt[f].theta + gps_theta(gen), cfg.sigma_pos);
+				else
+					pf->prediction(cfg.delta_t, cfg.sigma_pos, run.control[f - 1].velocity, run.control[f - 1].yawrate);
+
+				pf->updateWeights(cfg.sensor_range, cfg.sigma_landmark, observations[f], run.map);
+
+				const Particle best = pf->particle(pf->get_best_particle());
+				pf->associate(best, cfg.sensor_range, observations[f], run.map);
+
+				const Clock::time_point resample_start = Clock::now();
+				pf->resample();
+				const Clock::time_point end = Clock::now();
+
+				// The first frame only initializes the particles
+				if (f)
+				{
+					frame_us.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+					resample_us += std::chrono::duration<double, std::micro>(end - resample_start).count();
+				}
+
+				const std::vector<double> error = getError(run.gt[f].x, run.gt[f].y, run.gt[f].theta, run.map.to_global_x(best.x), run.map.to_global_y(best.y), best.theta);
+				sq_xy	 += error[0] * error[0] + error[1] * error[1];
+				sq_theta += error[2] * error[2];
+			}
+			result.heap_bytes = heap_in_use() - heap_before;
+			result.cache_hit  = pf->landmark_cache_hit_rate();
+		}
+
+		double total_us = 0.0;
+		for (unsigned int i = 0; i < frame_us.size(); ++i)
+			total_us += frame_us[i];
+
+		std::sort(frame_us.begin(), frame_us.end());
+
+		result.frames	  = frames_numb;
+		result.fps		  = total_us > 0.0 ? frame_us.size() / (total_us * 1e-6) : 0.0;
+		result.p50_us	  = percentile(frame_us, 0.5);
+		result.p99_us	  = percentile(frame_us, 0.99);
+		result.resample_us = frame_us.empty() ? 0.0 : resample_us / frame_us.size();
+		result.rmse_xy	  = std::sqrt(sq_xy / frames_numb);
+		result.rmse_theta = std::sqrt(sq_theta / frames_numb);
+	}
+	// A configuration is on the front unless another one of the same run is at least as fast and as accurate, and better in one
+	void mark_pareto(std::vector<Result> &results)
+	{
+		for (unsigned int i = 0; i < results.size(); ++i)
+		{
+			results[i].pareto = true;
+
+			for (unsigned int j = 0; j < results.size() && results[i].pareto; ++j)
+			{
+				const Result &a = results[i], &b = results[j];
+
+				if (j != i && b.run == a.run && b.fps >= a.fps && b.rmse_xy <= a.rmse_xy && (b.fps > a.fps || b.rmse_xy < a.rmse_xy))
+					results[i].pareto = false;
+			}
+		}
+	}
+	void write_csv(const std::string &path, const std::vector<Run> &runs, const std::vector<Result> &results)
+	{
+		std::ofstream out(path.c_str());
+		out << "run,landmarks,density_per_ha,particles,obs_per_frame,threads,islands,resampler,sort_interval,bucket_size,cache_margin,multiplicity,kernels,frames,fps,p50_us,p99_us,resample_us,cache_hit,heap_bytes,rmse_xy,rmse_theta,pareto\n";
+
+		for (unsigned int i = 0; i < results.size(); ++i)
+		{
+			const Result &r	  = results[i];
+			const Run	 &run = runs[r.run];
+
+			out << run.dir << "," << run.map.landmark_list.size() << "," << run.density << "," << r.particles << "," << r.obs << "," << r.threads << "," << r.islands << "," << resampler_name(r.resampler) << "," << r.sort_interval << "," << r.bucket_size << "," << r.cache_margin << "," << (r.multiplicity ? 1 : 0) << ","
+				<< cpu_level_name(r.level) << "," << r.frames << "," << r.fps << "," << r.p50_us << "," << r.p99_us << "," << r.resample_us << "," << r.cache_hit << "," << r.heap_bytes << ","
+				<< r.rmse_xy << "," << r.rmse_theta << "," << (r.pareto ? 1 : 0) << "\n";
+		}
+	}
+	void write_json(const std::string &path, const std::vector<Run> &runs, const std::vector<Result> &results)
+	{
+		nlohmann::json rows = nlohmann::json::array();
+
+		for (unsigned int i = 0; i < results.size(); ++i)
+		{
+			const Result &r	  = results[i];
+			const Run	 &run = runs[r.run];
+
+			nlohmann::json row;
+			row["run"]			 = run.dir;
+			row["landmarks"]	 = run.map.landmark_list.size();
+			row["density_per_ha"] = run.density;
+			row["particles"]	 = r.particles;
+			row["obs_per_frame"] = r.obs;
+			row["threads"]		 = r.threads;
+			row["islands"]		 = r.islands;
+			row["resampler"]	 = resampler_name(r.resampler);
+			row["sort_interval"] = r.sort_interval;
+			row["bucket_size"]	 = r.bucket_size;
+			row["cache_margin"]	 = r.cache_margin;
+			row["multiplicity"]	 = r.multiplicity;
+			row["kernels"]		 = cpu_level_name(r.level);
+			row["frames"]		 = r.frames;
+			row["fps"]			 = r.fps;
+			row["p50_us"]		 = r.p50_us;
+			row["p99_us"]		 = r.p99_us;
+			row["resample_us"]	 = r.resample_us;
+			row["cache_hit"]	 = r.cache_hit;
+			row["heap_bytes"]	 = r.heap_bytes;
+			row["rmse_xy"]		 = r.rmse_xy;
+			row["rmse_theta"]	 = r.rmse_theta;
+			row["pareto"]		 = r.pareto;
+			rows.push_back(row);
+		}
+
+		std::ofstream out(path.c_str());
+		out << rows.dump(1) << "\n";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: pf_bench run_dir[,run_dir...] [particles=100,1000] [obs=0,8] [threads=1,4] [islands=1,4] [resamplers=systematic,alias,metropolis,rejection] [sort=0,4] [bucket=0,2] [cache=0,2] [multiplicity=0,1] [kernels=generic,avx2|all] [frames=N] [cfg=file] [csv=file] [json=file]" << std::endl;
+		return 1;
+	}
+
+	std::map<std::string, std::string> args;
+	args["particles"] = "100,250,1000";
+	args["obs"]		  = "0";
+	args["threads"]	  = "1";
+	args["islands"]	  = "1";
+	args["resamplers"] = "systematic";
+	args["sort"]	  = "0";
+	args["bucket"]	  = "0";
+	args["cache"]	  = "0";
+	args["multiplicity"] = "0";
+	args["kernels"]	  = cpu_level_name(detect_cpu_level());
+	args["frames"]	  = "500";
+	args["cfg"]		  = "../data/cfg.txt";
+	args["csv"]		  = "pf_bench.csv";
+	args["json"]	  = "pf_bench.json";
+
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const size_t	  eq  = arg.find('=');
+
+		if (eq == std::string::npos || !args.count(arg.substr(0, eq)))
+		{
+			std::cerr << "Error: Unknown argument " << arg << std::endl;
+			return 1;
+		}
+		args[arg.substr(0, eq)] = arg.substr(eq + 1);
+	}
+
+	Config		 cfg;
+	FilterConfig filter_cfg;
+	cfg.read_cfg(args["cfg"]);
+
+	for (auto &r : cfg.mstringmap)
+		filter_cfg.set(r.first, r.second);
+
+	// Kernel levels above what the host supports are skipped
+	const CpuLevel			host = detect_cpu_level();
+	std::vector<CpuLevel>	levels;
+	const std::vector<std::string> kernel_names = split(args["kernels"]);
+
+	for (int l = 0; l <= host; ++l)
+		for (unsigned int i = 0; i < kernel_names.size(); ++i)
+			if (kernel_names[i] == "all" || kernel_names[i] == cpu_level_name(CpuLevel(l)))
+			{
+				levels.push_back(CpuLevel(l));
+				break;
+			}
+
+	const std::vector<unsigned int> particles = split_numbers(args["particles"]);
+	const std::vector<unsigned int> obs		  = split_numbers(args["obs"]);
+	const std::vector<unsigned int> threads	  = split_numbers(args["threads"]);
+	const std::vector<unsigned int> islands	  = split_numbers(args["islands"]);
+	const std::vector<std::string>	resampler_names = split(args["resamplers"]);
+	const std::vector<unsigned int> sorts	  = split_numbers(args["sort"]);
+	const std::vector<std::string>	bucket_names = split(args["bucket"]);
+	const std::vector<std::string>	cache_names = split(args["cache"]);
+	const std::vector<unsigned int> multiplicities = split_numbers(args["multiplicity"]);
+	const std::vector<std::string>	dirs	  = split(argv[1]);
+
+	std::vector<Run> runs(dirs.size());
+	for (unsigned int i = 0; i < dirs.size(); ++i)
+	{
+		if (!load_run(dirs[i], std::strtoul(args["frames"].c_str(), nullptr, 10), runs[i]))
+		{
+			std::cerr << "Error: " << dirs[i] << " is not a recorded data directory" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<double> buckets;
+	for (unsigned int i = 0; i < bucket_names.size(); ++i)
+		buckets.push_back(std::strtod(bucket_names[i].c_str(), nullptr));
+
+	std::vector<double> caches;
+	for (unsigned int i = 0; i < cache_names.size(); ++i)
+		caches.push_back(std::strtod(cache_names[i].c_str(), nullptr));
+
+	std::vector<ResamplerType> resamplers;
+	for (unsigned int i = 0; i < resampler_names.size(); ++i)
+		resamplers.push_back(String2Resampler()(resampler_names[i]));
+
+	if (levels.empty() || particles.empty() || obs.empty() || threads.empty() || islands.empty() || resamplers.empty() || sorts.empty() || buckets.empty() || caches.empty() || multiplicities.empty())
+	{
+		std::cerr << "Error: Nothing to sweep" << std::endl;
+		return 1;
+	}
+
+	std::vector<Result> results;
+
+	std::cout << std::fixed;
+	std::cout << "run  landmarks  particles  obs  threads  islands  resampler   sort  bucket  cache  mult  kernels    fps       p50[us]   p99[us]   resample[us]  hit   heap[kB]  rmse_xy  rmse_theta" << std::endl;
+
+	for (unsigned int r = 0; r < runs.size(); ++r)
+		for (unsigned int p = 0; p < particles.size(); ++p)
+			for (unsigned int o = 0; o < obs.size(); ++o)
+				for (unsigned int t = 0; t < threads.size(); ++t)
+					for (unsigned int k = 0; k < islands.size(); ++k)
+						for (unsigned int s = 0; s < resamplers.size(); ++s)
+							for (unsigned int q = 0; q < sorts.size(); ++q)
+							for (unsigned int b = 0; b < buckets.size(); ++b)
+							for (unsigned int c = 0; c < caches.size(); ++c)
+							for (unsigned int m = 0; m < multiplicities.size(); ++m)
+							for (unsigned int l = 0; l < levels.size(); ++l)
+							{
+								Result result;
+								result.run		 = r;
+								result.particles = particles[p];
+								result.obs		 = obs[o];
+								result.threads	 = threads[t];
+								result.islands	 = islands[k];
+								result.resampler = resamplers[s];
+								result.sort_interval = sorts[q];
+								result.bucket_size	 = buckets[b];
+								result.cache_margin	 = caches[c];
+								result.multiplicity	 = multiplicities[m] != 0;
+								result.level	 = levels[l];
+
+								bench(runs[r], filter_cfg, result);
+								results.push_back(result);
+
+								std::cout << std::setw(3) << r << "  " << std::setw(9) << runs[r].map.landmark_list.size() << "  " << std::setw(9) << result.particles << "  "
+										  << std::setw(3) << result.obs << "  " << std::setw(7) << result.threads << "  " << std::setw(7) << result.islands << "  "
+										  << std::setw(10) << resampler_name(result.resampler) << "  " << std::setw(4) << result.sort_interval << "  " << std::setprecision(1) << std::setw(6) << result.bucket_size << "  " << std::setw(5) << result.cache_margin << "  " << std::setw(4) << result.multiplicity << "  " << std::setw(7) << cpu_level_name(result.level) << "  "
+										  << std::setprecision(1) << std::setw(8) << result.fps << "  " << std::setw(8) << result.p50_us << "  " << std::setw(8) << result.p99_us << "  "
+										  << std::setw(12) << result.resample_us << "  " << std::setprecision(2) << std::setw(4) << result.cache_hit << "  " << std::setprecision(1) << std::setw(8) << result.heap_bytes / 1024.0 << "  "
+										  << std::setprecision(3) << std::setw(7) << result.rmse_xy << "  " << std::setw(10) << result.rmse_theta << std::endl;
+							}
+
+	mark_pareto(results);
+
+	std::cout << std::endl << "Pareto front (fps vs rmse_xy):" << std::endl;
+	for (unsigned int r = 0; r < runs.size(); ++r)
+	{
+		std::vector<const Result*> front;
+		for (unsigned int i = 0; i < results.size(); ++i)
+			if (results[i].run == r && results[i].pareto)
+				front.push_back(&results[i]);
+
+		std::sort(front.begin(), front.end(), [](const Result *a, const Result *b) { return a->fps > b->fps; });
+
+		std::cout << runs[r].dir << " (" << std::setprecision(1) << runs[r].density << " landmarks/ha)" << std::endl;
+		for (unsigned int i = 0; i < front.size(); ++i)
+			std::cout << "  particles " << front[i]->particles << ", obs " << front[i]->obs << ", threads " << front[i]->threads << ", islands " << front[i]->islands << ", " << resampler_name(front[i]->resampler) << ", sort " << front[i]->sort_interval << ", bucket " << front[i]->bucket_size << ", cache " << front[i]->cache_margin << (front[i]->multiplicity ? ", multiplicity" : "") << ", " << cpu_level_name(front[i]->level)
+					  << ": " << std::setprecision(1) << front[i]->fps << " frames/s, rmse " << std::setprecision(3) << front[i]->rmse_xy << " m" << std::endl;
+	}
+
+	write_csv(args["csv"], runs, results);
+	write_json(args["json"], runs, results);
+
+	std::cout << "Wrote " << args["csv"] << " and " << args["json"] << std::endl;
+	return 0;
+}
@@ -0,0 +1,144 @@
+#include "pf_c_api.h"
+#include "particle_filter.h"
+
+struct pf_filter
+{
+	Map					map;
+	ParticleFilter		pf;
+
+	unsigned int		particles_numb;
+	double				sensor_range;
+	std::vector<double>	sigma_pos;
+	std::vector<double>	sigma_landmark;
+
+	std::vector<scalar_t> obs_x;			// Conversion buffers, only used by the float32 policy
+	std::vector<scalar_t> obs_y;
+
+	Particle			best;
+	PoseEstimate		estimate;
+	bool				has_pose;
+};
+
+namespace
+{
+	// Observations are used in place when the scalar policy matches the ABI type
+	inline const double* observations(const double *values, const unsigned int &, std::vector<double> &)
+	{
+		return values;
+	}
+	template<typename Scalar>
+	const Scalar* observations(const double *values, const unsigned int &n, std::vector<Scalar> &buffer)
+	{
+		buffer.assign(values, values + n);
+		return buffer.data();
+	}
+}
+
+int pf_api_version(void)
+{
+	return PF_API_VERSION;
+}
+pf_filter* pf_create(const pf_config *config, const double *landmark_x, const double *landmark_y, const unsigned int *landmark_id, unsigned int landmarks_numb)
+{
+	if (!config || config->particles_numb == 0 || (landmarks_numb != 0 && (!landmark_x || !landmark_y || !landmark_id)))
+		return nullptr;
+
+	try
+	{
+		pf_filter *filter = new pf_filter();
+
+		filter->map.set_landmarks(landmark_x, landmark_y, landmark_id, landmarks_numb);
+		filter->particles_numb	= config->particles_numb;
+		filter->sensor_range	= config->sensor_range;
+		filter->sigma_pos		= std::vector<double>(config->sigma_pos, config->sigma_pos + 3);
+		filter->sigma_landmark	= std::vector<double>(config->sigma_landmark, config->sigma_landmark + 2);
+		filter->has_pose		= false;
+
+		filter->pf.set_threads(config->threads_numb);
+		filter->pf.set_association(config->association == PF_ASSOCIATION_KDTREE ? ASSOCIATION_KDTREE : ASSOCIATION_BRUTE_FORCE);
+
+		return filter;
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+void pf_destroy(pf_filter *filter)
+{
+	delete filter;
+}
+int pf_init(pf_filter *filter, double x, double y, double theta)
+{
+	if (!filter)
+		return PF_ERROR_INVALID_ARGUMENT;
+
+	try
+	{
+		filter->pf.init(filter->particles_numb, filter->map.to_local_x(x), filter->map.to_local_y(y), theta, filter->sigma_pos);
+		filter->has_pose = false;
+		return PF_OK;
+	}
+	catch (...)
+	{
+		return PF_ERROR_INTERNAL;
+	}
+}
+int pf_step(pf_filter *filter, double delta_t, double velocity, double yaw_rate, const double *obs_x, const double *obs_y, unsigned int obs_numb)
+{
+	if (!filter || (obs_numb != 0 && (!obs_x || !obs_y)))
+		return PF_ERROR_INVALID_ARGUMENT;
+
+	if (!filter->pf.initialized())
+		return PF_ERROR_NOT_INITIALIZED;
+
+	try
+	{
+		ParticleFilter &pf = filter->pf;
+
+		pf.prediction(delta_t, filter->sigma_pos, velocity, yaw_rate);
+		pf.updateWeights(filter->sensor_range, filter->sigma_landmark,
+						 observations(obs_x, obs_numb, filter->obs_x),
+						 observations(obs_y, obs_numb, filter->obs_y),
+						 obs_numb, filter->map);
+
+		filter->best	 = pf.particle(pf.get_best_particle(&filter->estimate));
+		filter->has_pose = true;
+
+		pf.resample();
+		return PF_OK;
+	}
+	catch (...)
+	{
+		return PF_ERROR_INTERNAL;
+	}
+}
+int pf_get_pose(const pf_filter *filter, pf_pose *best, pf_pose *mean, double *covariance)
+{
+	if (!filter)
+		return PF_ERROR_INVALID_ARGUMENT;
+
+	if (!filter->has_pose)
+		return PF_ERROR_NOT_INITIALIZED;
+
+	if (best)
+	{
+		best->x		 = filter->map.to_global_x(filter->best.x);
+		best->y		 = filter->map.to_global_y(filter->best.y);
+		best->theta	 = filter->best.theta;
+		best->weight = filter->best.weight;
+	}
+	if (mean)
+	{
+		mean->x		 = filter->map.to_global_x(filter->estimate.x);
+		mean->y		 = filter->map.to_global_y(filter->estimate.y);
+		mean->theta	 = filter->estimate.theta;
+		mean->weight = 0.0;
+	}
+	if (covariance)
+	{
+		for (unsigned int i = 0; i < 9; ++i)
+			covariance[i] = filter->estimate.cov[i];
+	}
+	return PF_OK;
+}
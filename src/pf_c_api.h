@@ -0,0 +1,71 @@
+#ifndef __PF_C_API_H__
+#define __PF_C_API_H__
+
+/*
+ * Stable C interface of libparticlefilter, for embedding the localizer in-process.
+ * All positions are global map coordinates. Arrays passed in are owned by the
+ * caller and only read during the call; with the default float64 scalar policy
+ * observations are consumed in place without being copied.
+ * Functions returning int return PF_OK or a negative PF_ERROR_* code.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PF_API_VERSION				1
+
+#define PF_OK						0
+#define PF_ERROR_INVALID_ARGUMENT	-1
+#define PF_ERROR_NOT_INITIALIZED	-2
+#define PF_ERROR_INTERNAL			-3
+
+#define PF_ASSOCIATION_BRUTE_FORCE	0
+#define PF_ASSOCIATION_KDTREE		1
+
+typedef struct pf_filter pf_filter;
+
+typedef struct pf_config
+{
+	unsigned int	particles_numb;
+	double			sensor_range;			/* Sensor range [m] */
+	double			sigma_pos[3];			/* GPS measurement uncertainty [x [m], y [m], theta [rad]] */
+	double			sigma_landmark[2];		/* Landmark measurement uncertainty [x [m], y [m]] */
+	unsigned int	threads_numb;			/* Filter threads, 0 uses all hardware threads */
+	int				association;			/* PF_ASSOCIATION_* */
+} pf_config;
+
+typedef struct pf_pose
+{
+	double			x;
+	double			y;
+	double			theta;
+	double			weight;					/* Particle weight, 0 for the mean pose */
+} pf_pose;
+
+int			pf_api_version	(void);
+/*
+ * Creates a filter over the given landmarks, NULL on invalid arguments.
+ */
+pf_filter*	pf_create		(const pf_config *config, const double *landmark_x, const double *landmark_y, const unsigned int *landmark_id, unsigned int landmarks_numb);
+void		pf_destroy		(pf_filter *filter);
+/*
+ * Initializes the particles around a first (GPS) pose.
+ */
+int			pf_init			(pf_filter *filter, double x, double y, double theta);
+/*
+ * Runs prediction, weight update and resampling for one frame.
+ * obs_x/obs_y hold obs_numb observations in vehicle coordinates.
+ */
+int			pf_step			(pf_filter *filter, double delta_t, double velocity, double yaw_rate, const double *obs_x, const double *obs_y, unsigned int obs_numb);
+/*
+ * Pose estimates of the last pf_step(). Any output pointer may be NULL; covariance
+ * is a row-major 3x3 matrix of (x, y, theta).
+ */
+int			pf_get_pose		(const pf_filter *filter, pf_pose *best, pf_pose *mean, double *covariance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PF_C_API_H__ */
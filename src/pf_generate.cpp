@@ -0,0 +1,195 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sys/stat.h>
+#include "helper_functions.h"
+#include "kdtree.h"
+
+/*
+ * Generates a synthetic localization run in the data/ formats: map_data.txt,
+ * control_data.txt, gt_data.txt and observation/observations_NNNNNN.txt.
+ * The map is a square sized for the requested density [landmarks per hectare]; a
+ * clustering fraction of the landmarks is placed in Gaussian clusters, the rest
+ * uniformly. The vehicle drives at constant speed with a random-walk yaw rate that
+ * steers it back inside the map, and observes every landmark within sensor range.
+ * Usage: pf_generate out_dir [landmarks] [density] [clustering] [frames] [seed]
+ */
+namespace
+{
+	const double	DELTA_T				= 0.1;		// [s]
+	const double	VELOCITY			= 10.0;		// [m/s]
+	const double	MAX_YAWRATE			= 0.3;		// [rad/s]
+	const double	SENSOR_RANGE		= 50.0;		// [m]
+	const double	OBS_STD				= 0.3;		// Observation noise, matches LANDMARK_STD [m]
+	const double	CLUSTER_STD			= 15.0;		// Spread of one landmark cluster [m]
+	const unsigned	CLUSTER_SIZE		= 50;		// Mean landmarks per cluster
+
+	FILE* open_output(const std::string &path)
+	{
+		FILE *file = std::fopen(path.c_str(), "w");
+
+		if (!file)
+			std::cerr << "Error: Could not write " << path << std::endl;
+		else
+			std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+		return file;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: pf_generate out_dir [landmarks] [density] [clustering] [frames] [seed]" << std::endl;
+		return 1;
+	}
+
+	const std::string	out_dir		 = argv[1];
+	const unsigned int	landmarks	 = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+	const double		density		 = argc > 3 ? std::atof(argv[3]) : 10.0;
+	const double		clustering	 = argc > 4 ? std::min(1.0, std::max(0.0, std::atof(argv[4]))) : 0.0;
+	const unsigned int	frames_numb	 = argc > 5 ? std::atoi(argv[5]) : 2000;
+	const unsigned int	seed		 = argc > 6 ? std::atoi(argv[6]) : 1;
+
+	if (landmarks == 0 || density <= 0.0)
+	{
+		std::cerr << "Error: landmarks and density must be positive" << std::endl;
+		return 1;
+	}
+
+	// One hectare is 100 m x 100 m
+	const double half_size = 50.0 * std::sqrt(landmarks / density);
+
+	std::mt19937						gen(seed);
+	std::uniform_real_distribution<double> coord(-half_size, half_size);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	std::normal_distribution<double>	cluster(0.0, CLUSTER_STD);
+	std::normal_distribution<double>	obs_noise(0.0, OBS_STD);
+	std::normal_distribution<double>	yaw_noise(0.0, 0.05);
+
+	// Landmarks, global coordinates
+	std::vector<double>			x(landmarks), y(landmarks);
+	std::vector<unsigned int>	ids(landmarks);
+
+	double		 cx = 0.0, cy = 0.0;
+	unsigned int clustered = 0;
+	for (unsigned int i = 0; i < landmarks; ++i)
+	{
+		ids[i] = i + 1;
+
+		if (unit(gen) >= clustering)
+		{
+			x[i] = coord(gen);
+			y[i] = coord(gen);
+			continue;
+		}
+
+		if (clustered++ % CLUSTER_SIZE == 0)
+		{
+			cx = coord(gen);
+			cy = coord(gen);
+		}
+		x[i] = std::max(-half_size, std::min(half_size, cx + cluster(gen)));
+		y[i] = std::max(-half_size, std::min(half_size, cy + cluster(gen)));
+	}
+
+	if (mkdir(out_dir.c_str(), 0755) != 0 && errno != EEXIST)
+	{
+		std::cerr << "Error: Could not create " << out_dir << std::endl;
+		return 1;
+	}
+	mkdir((out_dir + "/observation").c_str(), 0755);
+
+	FILE *map_file = open_output(out_dir + "/map_data.txt");
+	if (!map_file)
+		return 1;
+
+	for (unsigned int i = 0; i < landmarks; ++i)
+		std::fprintf(map_file, "%.3f\t%.3f\t%u\n", x[i], y[i], ids[i]);
+	std::fclose(map_file);
+
+	// Range queries for the observations go through the filter's own k-d tree
+	Map map;
+	map.set_landmarks(x.data(), y.data(), ids.data(), landmarks);
+
+	KdTree tree;
+	tree.build(map.landmark_list);
+
+	FILE *control_file = open_output(out_dir + "/control_data.txt");
+	FILE *gt_file	   = open_output(out_dir + "/gt_data.txt");
+	if (!control_file || !gt_file)
+		return 1;
+
+	// Start at the map centre, heading along x; the drive stays 2 sensor ranges off the edges when the map allows
+	const double margin	 = std::max(0.0, half_size - 2.0 * SENSOR_RANGE);
+	ground_truth gt		 = { 0.0, 0.0, 0.0 };
+	double		 yawrate = 0.0;
+
+	std::vector<unsigned int>	visible;
+	unsigned long				observations_numb = 0;
+
+	for (unsigned int f = 0; f < frames_numb; ++f)
+	{
+		std::fprintf(gt_file, "%.4f %.4f %.4f\n", gt.x, gt.y, gt.theta);
+
+		char path[64];
+		std::snprintf(path, sizeof(path), "/observation/observations_%06u.txt", f + 1);
+
+		FILE *obs_file = std::fopen((out_dir + path).c_str(), "w");
+		if (!obs_file)
+		{
+			std::cerr << "Error: Could not write " << out_dir << path << std::endl;
+			return 1;
+		}
+
+		visible.clear();
+		tree.radius(map.to_local_x(gt.x), map.to_local_y(gt.y), SENSOR_RANGE * SENSOR_RANGE, visible);
+
+		const double cos_theta = std::cos(gt.theta), sin_theta = std::sin(gt.theta);
+		for (unsigned int i = 0; i < visible.size(); ++i)
+		{
+			// The map keeps its landmarks in curve order, the id leads back to the generated position
+			const unsigned int l = map.landmark_list[visible[i]].id_i - 1;
+			const double dx = x[l] - gt.x;
+			const double dy = y[l] - gt.y;
+
+			std::fprintf(obs_file, "%.4f %.4f\n", dx * cos_theta + dy * sin_theta + obs_noise(gen), -dx * sin_theta + dy * cos_theta + obs_noise(gen));
+		}
+		std::fclose(obs_file);
+		observations_numb += visible.size();
+
+		// Yaw rate random walk, turning towards the centre once outside the margin
+		const double off_x = std::fabs(gt.x) - margin;
+		const double off_y = std::fabs(gt.y) - margin;
+
+		if (off_x > 0.0 || off_y > 0.0)
+		{
+			const double to_centre = std::atan2(-gt.y, -gt.x) - gt.theta;
+			yawrate = MAX_YAWRATE * std::sin(to_centre);
+		}
+		else
+			yawrate = std::max(-MAX_YAWRATE, std::min(MAX_YAWRATE, yawrate + yaw_noise(gen)));
+
+		// The integration below divides by the yaw rate; it is rounded to what the control file stores
+		yawrate = std::round(yawrate * 1e6) * 1e-6;
+		if (std::fabs(yawrate) < 1e-6)
+			yawrate = 1e-6;
+
+		std::fprintf(control_file, "%.4f %.6f\n", VELOCITY, yawrate);
+
+		gt.x	 += VELOCITY / yawrate * (std::sin(gt.theta + yawrate * DELTA_T) - std::sin(gt.theta));
+		gt.y	 += VELOCITY / yawrate * (std::cos(gt.theta) - std::cos(gt.theta + yawrate * DELTA_T));
+		gt.theta  = std::fmod(gt.theta + yawrate * DELTA_T, 2.0 * PI);
+	}
+
+	std::fclose(control_file);
+	std::fclose(gt_file);
+
+	std::cout << "Landmarks       = " << landmarks << " over " << 2.0 * half_size << " m x " << 2.0 * half_size << " m (clustering " << clustering << ")" << std::endl;
+	std::cout << "Frames          = " << frames_numb << ", " << double(observations_numb) / std::max(1u, frames_numb) << " observations per frame" << std::endl;
+	return 0;
+}
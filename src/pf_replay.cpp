@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include "config.h"
+#include "session.h"
+
+/*
+ * Feeds a telemetry capture back through the full parse -> filter -> serialize path,
+ * one Session per captured session, at the captured pace scaled by speed or as fast
+ * as possible. Reports the per-frame processing time, how far the replay fell behind
+ * the schedule and, in PF_ALLOC_STATS builds, the allocations per frame. Flight recorder
+ * dumps start from a filter checkpoint and carry the originally recorded stage timings,
+ * which are printed next to the replayed ones for the slowest frame.
+ * Usage: pf_replay capture_file [speed|max] [cfg_file] [map_file]
+ */
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double percentile(const std::vector<double> &sorted, const double &p)
+	{
+		return sorted.empty() ? 0.0 : sorted[std::min<size_t>(sorted.size() - 1, size_t(p * sorted.size()))];
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: pf_replay capture_file [speed|max] [cfg_file] [map_file]" << std::endl;
+		return 1;
+	}
+
+	const std::string	capture_path = argv[1];
+	const std::string	speed_arg	 = argc > 2 ? argv[2] : "1";
+	const std::string	cfg_path	 = argc > 3 ? argv[3] : "../data/cfg.txt";
+	const std::string	map_path	 = argc > 4 ? argv[4] : "../data/map_data.txt";
+
+	// 0 replays as fast as possible
+	const double speed = speed_arg == "max" ? 0.0 : std::atof(speed_arg.c_str());
+
+	Map map;
+	if (!read_map_data(map_path, map))
+	{
+		std::cerr << "Error: Could not open map file " << map_path << std::endl;
+		return 1;
+	}
+
+	Config		 cfg;
+	FilterConfig filter_cfg;
+	cfg.read_cfg(cfg_path);
+
+	for (auto &r : cfg.mstringmap)
+		filter_cfg.set(r.first, r.second);
+
+	CaptureReader reader;
+	if (!reader.open(capture_path))
+	{
+		std::cerr << "Error: " << capture_path << " is not a telemetry capture" << std::endl;
+		return 1;
+	}
+
+	std::map<uint32_t, std::unique_ptr<Session>> sessions;
+	std::unique_ptr<TelemetryFrame>	frame(new TelemetryFrame());
+	PoseFrame						pose;
+	CaptureRecord					rec;
+	std::vector<char>				payload;
+	std::string						reply;
+	std::vector<double>				processing_us;
+	alloc_stats::Report				alloc_report;
+	FilterState						state;
+
+	// Slowest recorded frame of a flight recorder dump, and how long its replay took
+	double							recorded_ns[alloc_stats::STAGE_COUNT] = {};
+	double							recorded_total_ns = 0.0, recorded_replay_us = 0.0;
+
+	unsigned long		sessions_numb = 0, malformed = 0;
+	uint64_t			last_t_ns	  = 0;
+	double				max_lag_ms	  = 0.0;
+	const Clock::time_point start	  = Clock::now();
+
+	while (reader.next(rec, payload))
+	{
+		last_t_ns = rec.t_ns;
+
+		if (rec.kind == CAPTURE_CLOSE)
+		{
+			sessions.erase(rec.session);
+			continue;
+		}
+
+		std::unique_ptr<Session> &session = sessions[rec.session];
+		if (!session || rec.kind == CAPTURE_OPEN)
+		{
+			session.reset(new Session(filter_cfg, map));
+			++sessions_numb;
+		}
+
+		if (rec.kind == CAPTURE_STATE)
+		{
+			if (decode_filter_state(payload.data(), payload.size(), state))
+				session->restore(state);
+			else
+				++malformed;
+			continue;
+		}
+
+		if (rec.kind == CAPTURE_TIMING && payload.size() == sizeof(recorded_ns) && !processing_us.empty())
+		{
+			double total_ns = 0.0;
+			for (unsigned int i = 0; i < alloc_stats::STAGE_COUNT; ++i)
+				total_ns += reinterpret_cast<const double*>(payload.data())[i];
+
+			if (total_ns > recorded_total_ns)
+			{
+				recorded_total_ns  = total_ns;
+				recorded_replay_us = processing_us.back();
+				std::memcpy(recorded_ns, payload.data(), sizeof(recorded_ns));
+			}
+			continue;
+		}
+
+		if (rec.kind != CAPTURE_TEXT && rec.kind != CAPTURE_FRAME)
+			continue;
+
+		if (speed > 0.0)
+		{
+			const Clock::time_point due = start + std::chrono::nanoseconds(uint64_t(rec.t_ns / speed));
+			std::this_thread::sleep_until(due);
+			max_lag_ms = std::max(max_lag_ms, std::chrono::duration<double, std::milli>(Clock::now() - due).count());
+		}
+
+		const Clock::time_point frame_start = Clock::now();
+		alloc_report.begin();
+
+		if (rec.kind == CAPTURE_TEXT)
+			session->handle_message(payload.data(), payload.size(), reply);
+
+		else if (decode_telemetry(payload.data(), payload.size(), *frame))
+			session->handle_frame(*frame, pose);
+
+		else
+			++malformed;
+
+		alloc_report.end();
+		processing_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - frame_start).count());
+	}
+
+	const double wall_s = std::chrono::duration<double>(Clock::now() - start).count();
+	std::sort(processing_us.begin(), processing_us.end());
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Sessions        = " << sessions_numb << std::endl;
+	std::cout << "Frames          = " << processing_us.size() << " (" << malformed << " malformed)" << std::endl;
+	std::cout << "Captured        = " << last_t_ns * 1e-9 << " s, replayed in " << wall_s << " s (" << processing_us.size() / wall_s << " frames/s)" << std::endl;
+	std::cout << "Frame [us]      = p50 " << percentile(processing_us, 0.5) << "  p99 " << percentile(processing_us, 0.99)
+			  << "  p99.9 " << percentile(processing_us, 0.999) << "  max " << (processing_us.empty() ? 0.0 : processing_us.back()) << std::endl;
+
+	if (speed > 0.0)
+		std::cout << "Max lag         = " << max_lag_ms << " ms behind schedule" << std::endl;
+
+	if (recorded_total_ns > 0.0)
+	{
+		std::cout << "Recorded max    = " << recorded_total_ns * 1e-3 << " us (replayed in " << recorded_replay_us << " us):";
+		for (unsigned int i = 0; i < alloc_stats::STAGE_COUNT; ++i)
+			std::cout << " " << alloc_stats::stage_name(alloc_stats::Stage(i)) << " " << recorded_ns[i] * 1e-3;
+		std::cout << std::endl;
+	}
+
+	if (alloc_stats::enabled)
+		alloc_report.print(std::cout, "frame");
+
+	return 0;
+}
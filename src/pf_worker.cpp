@@ -0,0 +1,33 @@
+#include <cstdlib>
+#include <iostream>
+#include "distributed.h"
+
+/*
+ * Worker process of the distributed filter. Every coordinator connection, i.e. every
+ * vehicle Session of a Master started with WORKERS, gets its own particle shard. The map
+ * must be the one Master uses; a coordinator with a different landmark count is refused.
+ * Usage: pf_worker [port] [map_file]
+ */
+int main(int argc, char **argv)
+{
+	const unsigned int	port	 = argc > 1 ? std::atoi(argv[1]) : 4600;
+	const std::string	map_path = argc > 2 ? argv[2] : "../data/map_data.txt";
+
+	Map map;
+	if (!read_map_data(map_path, map))
+	{
+		std::cerr << "Error: Could not open map file " << map_path << std::endl;
+		return 1;
+	}
+
+	ShardServer server(map);
+	if (!server.listen_tcp(port))
+	{
+		std::cerr << "Error: Could not listen on port " << port << std::endl;
+		return 1;
+	}
+
+	std::cout << "Serving particle shards on port " << port << " (" << map.landmark_list.size() << " landmarks)" << std::endl;
+	server.run();
+	return 1;
+}
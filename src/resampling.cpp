@@ -0,0 +1,162 @@
+#include "resampling.h"
+
+#include <numeric>
+
+const unsigned int AliasTable::BLOCK;
+
+const char* resampler_name(const ResamplerType &type)
+{
+	static const char* names[] = { "systematic", "alias", "metropolis", "rejection" };
+	return names[type];
+}
+namespace
+{
+	const double COIN_SCALE = 4294967296.0;		// 2^32
+}
+
+bool AliasTable::build(const double *weights, const unsigned int &weights_numb, ThreadPool *pool)
+{
+	n = 0;
+	top.clear();
+
+	const unsigned int blocks = (weights_numb + BLOCK - 1) / BLOCK;
+
+	slots.resize(weights_numb);
+	block_sum.resize(blocks);
+
+	// Blocks only depend on their own weights; the sums are taken here too so the weights are read once per build
+	auto task = [&](unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		for (unsigned int b = begin; b < end; ++b)
+		{
+			const unsigned int first = b * BLOCK;
+			const unsigned int count = std::min(BLOCK, weights_numb - first);
+
+			block_sum[b] = std::accumulate(weights + first, weights + first + count, 0.0);
+			build_range(weights + first, count, block_sum[b], slots.data() + first);
+		}
+	};
+
+	if (pool && blocks > 1)
+		pool->parallel_for(blocks, 1, task);
+	else
+		task(0, 0, blocks);
+
+	const double sum = std::accumulate(block_sum.begin(), block_sum.end(), 0.0);
+	if (!(sum > 0.0))
+		return false;
+
+	if (blocks > 1)
+	{
+		top.resize(blocks);
+		build_range(block_sum.data(), blocks, sum, top.data());
+	}
+
+	n = weights_numb;
+	return true;
+}
+void AliasTable::build_range(const double *weights, const unsigned int &count, const double &sum, Slot *slot)
+{
+	// Slot i keeps itself with probability prob, else it yields alias; prob >= 1 always keeps it
+	auto set = [slot](const unsigned int &i, const double &prob, const unsigned int &alias)
+	{
+		slot[i].threshold = prob < 1.0 ? static_cast<uint32_t>(prob * COIN_SCALE) : 0xFFFFFFFFu;
+		slot[i].alias	  = prob < 1.0 ? alias : i;
+	};
+
+	// A block without weight is never picked by the top table, any valid content will do
+	if (!(sum > 0.0))
+	{
+		for (unsigned int i = 0; i < count; ++i)
+			set(i, 1.0, i);
+		return;
+	}
+
+	// Weights scaled to a mean of 1: light slots (< 1) are topped up by the current heavy one,
+	// which turns light itself once its residual drops below 1 and is then topped up by the next
+	// heavy one. Lights and heavies are each scanned once in index order, no work lists needed.
+	const double scale = count / sum;
+
+	unsigned int light = 0, heavy = 0;
+	while (light < count && weights[light] * scale >= 1.0)
+		++light;
+	while (heavy < count && weights[heavy] * scale < 1.0)
+		++heavy;
+
+	double residual = heavy < count ? weights[heavy] * scale : 0.0;
+
+	while (heavy < count)
+	{
+		if (residual >= 1.0)
+		{
+			if (light == count)
+				break;
+
+			const double prob = weights[light] * scale;
+			set(light, prob, heavy);
+			residual -= 1.0 - prob;
+
+			while (++light < count && weights[light] * scale >= 1.0) {}
+			continue;
+		}
+
+		unsigned int next = heavy;
+		while (++next < count && weights[next] * scale < 1.0) {}
+
+		if (next == count)
+			break;
+
+		set(heavy, residual, next);
+		residual = weights[next] * scale - (1.0 - residual);
+		heavy	 = next;
+	}
+
+	// What is left is 1 up to rounding: the current heavy and the unvisited heavies and lights keep their slot
+	if (heavy < count)
+	{
+		set(heavy, 1.0, heavy);
+
+		while (++heavy < count)
+			if (weights[heavy] * scale >= 1.0)
+				set(heavy, 1.0, heavy);
+	}
+	for (; light < count; ++light)
+		if (weights[light] * scale < 1.0)
+			set(light, 1.0, light);
+}
+void resampling::metropolis(const double *weights, const unsigned int &n, const unsigned int &iterations, std::mt19937 &generator,
+							const unsigned int &first, const unsigned int &last, unsigned int *ancestors)
+{
+	for (unsigned int i = first; i < last; ++i)
+	{
+		unsigned int k		= i % n;
+		double		 weight = weights[k];
+
+		for (unsigned int b = 0; b < iterations; ++b)
+		{
+			// Proposal from the high bits of a multiply, u compared as u * w_current <= w_proposal
+			const unsigned int j = static_cast<unsigned int>((static_cast<uint64_t>(generator()) * n) >> 32);
+			const double	   u = generator() / COIN_SCALE;
+
+			if (u * weight <= weights[j])
+			{
+				k	   = j;
+				weight = weights[j];
+			}
+		}
+		ancestors[i] = k;
+	}
+}
+void resampling::rejection(const double *weights, const unsigned int &n, const double &max_weight, const unsigned int &iterations, std::mt19937 &generator,
+						   const unsigned int &first, const unsigned int &last, unsigned int *ancestors)
+{
+	for (unsigned int i = first; i < last; ++i)
+	{
+		unsigned int j = i % n;
+
+		for (unsigned int tries = 1; generator() / COIN_SCALE * max_weight > weights[j] && tries != iterations; ++tries)
+			j = static_cast<unsigned int>((static_cast<uint64_t>(generator()) * n) >> 32);
+
+		ancestors[i] = j;
+	}
+}
@@ -0,0 +1,121 @@
+#ifndef __RESAMPLING_H__
+#define __RESAMPLING_H__
+
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "thread_pool.h"
+
+enum ResamplerType
+{
+	RESAMPLER_SYSTEMATIC = 0,
+	RESAMPLER_ALIAS,
+	RESAMPLER_METROPOLIS,
+	RESAMPLER_REJECTION
+};
+
+const char* resampler_name(const ResamplerType &type);
+
+struct String2Resampler
+{
+	ResamplerType operator()(const std::string &str) const
+	{
+		if (str == "alias")
+			return RESAMPLER_ALIAS;
+
+		if (str == "metropolis")
+			return RESAMPLER_METROPOLIS;
+
+		if (str == "rejection")
+			return RESAMPLER_REJECTION;
+
+		return RESAMPLER_SYSTEMATIC;
+	}
+};
+
+/*
+ * Walker/Vose alias table: O(n) to build, O(1) per weighted draw. Every slot holds a
+ * probability and an alias, a draw picks a slot uniformly and keeps it or takes its alias.
+ * The weights are split into fixed blocks that are built independently (in parallel when
+ * a pool is given) and a small table over the block sums picks the block first, so the
+ * table and every draw sequence are the same whatever the thread count.
+ */
+class AliasTable
+{
+public:
+	// Slots per independently built block
+	static const unsigned int BLOCK = 4096;
+
+	AliasTable() : n(0) {}
+	/**
+	 * build Builds the table over weights[0, n).
+	 * @param pool Optional pool to build the blocks on, not usable from inside one of its tasks
+	 * @output False if the weights do not sum to a positive value, the table is then empty
+	 */
+	bool build(const double *weights, const unsigned int &weights_numb, ThreadPool *pool = nullptr);
+	/**
+	 * draw Index in [0, size()) with probability weights[index] / sum of weights.
+	 * @param generator 32-bit generator (std::mt19937), called once per level of the table
+	 */
+	template<typename Generator>
+	unsigned int draw(Generator &generator) const
+	{
+		const unsigned int block = top.size() > 1 ? pick(top.data(), top.size(), static_cast<uint32_t>(generator())) : 0;
+		const unsigned int begin = block * BLOCK;
+
+		return begin + pick(slots.data() + begin, std::min(BLOCK, n - begin), static_cast<uint32_t>(generator()));
+	}
+
+	unsigned int size() const { return n; }
+private:
+	// Keep probability in 1/2^32 units and alias, relative to the block; one cache line holds 8
+	struct Slot
+	{
+		uint32_t				threshold;
+		uint32_t				alias;
+	};
+
+	// The high bits of bits * count pick the slot, the low bits are the uniform coin against its threshold
+	static unsigned int pick(const Slot *slot, const unsigned int &count, const uint32_t &bits)
+	{
+		const uint64_t	   x = static_cast<uint64_t>(bits) * count;
+		const unsigned int i = static_cast<unsigned int>(x >> 32);
+
+		return static_cast<uint32_t>(x) < slot[i].threshold ? i : slot[i].alias;
+	}
+	// Vose's construction as a single sweep over weights[0, count)
+	static void build_range(const double *weights, const unsigned int &count, const double &sum, Slot *slot);
+
+	unsigned int				n;
+	std::vector<Slot>			slots;
+	std::vector<double>			block_sum;
+	std::vector<Slot>			top;		// Over block_sum, empty with a single block
+};
+
+/*
+ * Resamplers without a collective operation over the weights (Murray, Lee & Jacob, "Parallel
+ * resampling in the particle filter"), so any range of outputs can be drawn on its own. Both
+ * write ancestors[i] for i in [first, last), drawn from weights[0, n), and start output i
+ * from particle i % n. Ratios of weights are all they need, the weights need not be normalized.
+ */
+namespace resampling
+{
+	/**
+	 * metropolis Runs iterations Metropolis steps per output, each proposing a uniformly drawn
+	 *   particle and accepting it with probability min(1, w_proposal / w_current). Fewer
+	 *   iterations are faster and more biased towards the starting particle.
+	 */
+	void metropolis	(const double *weights, const unsigned int &n, const unsigned int &iterations, std::mt19937 &generator,
+					 const unsigned int &first, const unsigned int &last, unsigned int *ancestors);
+	/**
+	 * rejection Accepts a proposal with probability w_proposal / max_weight, the first proposal
+	 *   being the starting particle and the next ones uniform. Unbiased, but takes max_weight / mean
+	 *   proposals on average; after iterations rejected proposals the last one is kept (0 never gives up).
+	 */
+	void rejection	(const double *weights, const unsigned int &n, const double &max_weight, const unsigned int &iterations, std::mt19937 &generator,
+					 const unsigned int &first, const unsigned int &last, unsigned int *ancestors);
+}
+
+#endif /* __RESAMPLING_H__ */
@@ -0,0 +1,29 @@
+#ifndef __SCALAR_H__
+#define __SCALAR_H__
+
+/*
+ * Scalar policy of the filter, selected at build time with -DPF_FLOAT32=ON.
+ * Float32 halves memory traffic and doubles SIMD width; to keep precision the map
+ * and the particles then live in a local frame centred on the map (see Map::origin_x).
+ * Particle weights stay in double, a product of likelihoods underflows float quickly.
+ */
+struct Float32Policy
+{
+	typedef float	scalar;
+	static const char* name() { return "float32"; }
+};
+struct Float64Policy
+{
+	typedef double	scalar;
+	static const char* name() { return "float64"; }
+};
+
+#ifdef PF_FLOAT32
+typedef Float32Policy ScalarPolicy;
+#else
+typedef Float64Policy ScalarPolicy;
+#endif
+
+typedef ScalarPolicy::scalar scalar_t;
+
+#endif /* __SCALAR_H__ */
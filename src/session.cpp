@@ -0,0 +1,331 @@
+#include "session.h"
+#include "distributed.h"
+#include "json.hpp"
+
+namespace
+{
+	// Flight recorder ids for sessions that are not captured
+	std::atomic<uint32_t> recorder_sessions(1u << 31);
+}
+
+
+bool FilterConfig::set(const std::string &key, const std::string &value)
+{
+	if (key == "TIMESTEP")
+		delta_t = String2Float()(value);
+
+	else if (key == "SENSOR_RANGE")
+		sensor_range = String2Int()(value);
+
+	else if (key == "PARTICLES_NUMBER")
+		particles_numb = String2Int()(value);
+
+	else if (key == "ASSOCIATION")
+		association = String2Association()(value);
+
+	else if (key == "RESAMPLER")
+		resampler = String2Resampler()(value);
+
+	else if (key == "RESAMPLER_ITERATIONS")
+		resampler_iterations = String2Int()(value);
+
+	else if (key == "PARTICLE_SORT_INTERVAL")
+		sort_interval = String2Int()(value);
+
+	else if (key == "LANDMARK_BUCKET_SIZE")
+		bucket_size = String2Float()(value);
+
+	else if (key == "LANDMARK_CACHE_MARGIN")
+		cache_margin = String2Float()(value);
+
+	else if (key == "PARTICLE_MULTIPLICITY")
+		multiplicity = String2Int()(value) != 0;
+
+	else if (key == "THREADS")
+		threads_numb = String2Int()(value);
+
+	else if (key == "NUMA")
+		numa = String2Int()(value) != 0;
+
+	else if (key == "PUBLISH_ESTIMATE")
+		publish_estimate = String2Int()(value) != 0;
+
+	else if (key == "ISLANDS")
+		islands_numb = String2Int()(value);
+
+	else if (key == "ISLAND_MIGRATION_INTERVAL")
+		migration_interval = String2Int()(value);
+
+	else if (key == "ISLAND_MIGRATION_RATE")
+		migration_rate = String2Float()(value);
+
+	else if (key == "WORKERS")
+	{
+		std::istringstream iss(value);
+		std::string		   worker;
+
+		workers.clear();
+		while (std::getline(iss, worker, ','))
+			if (!worker.empty() && worker != "0")
+				workers.push_back(worker);
+	}
+
+	else if (key == "FLIGHT_RECORDER_FRAMES")
+		recorder_frames = String2Int()(value);
+
+	else if (key == "LATENCY_BUDGET_US")
+		latency_budget_us = String2Float()(value);
+
+	else if (key == "FLIGHT_RECORDER_DIR")
+		recorder_dir = value;
+
+	else if (key == "GPS_STD")
+		sigma_pos = String2Array()(value);
+
+	else if (key == "LANDMARK_STD")
+		sigma_landmark = String2Array()(value);
+
+	else
+		return false;
+
+	return true;
+}
+FilterResources::FilterResources(const FilterConfig &config, const Map &map) : association(make_association_engine(config.association))
+{
+	pool.start(config.threads_numb);
+	association->build(map);
+}
+void configure(ParticleFilter &pf, const FilterConfig &cfg, FilterResources *shared)
+{
+	if (shared)
+	{
+		pf.set_pool(&shared->pool);
+		pf.set_association(shared->association);
+	}
+	else
+	{
+		pf.set_threads(cfg.threads_numb);
+		pf.set_association(cfg.association);
+	}
+	pf.set_numa(cfg.numa);
+	pf.set_resampler(cfg.resampler, cfg.resampler_iterations);
+	pf.set_sort_interval(cfg.sort_interval);
+	pf.set_bucket_size(cfg.bucket_size);
+	pf.set_landmark_cache(cfg.cache_margin);
+	pf.set_multiplicity(cfg.multiplicity);
+	pf.set_islands(cfg.islands_numb, cfg.migration_interval, cfg.migration_rate);
+}
+Session::Session(const FilterConfig &config, const Map &map_landmarks, CaptureWriter *capture_writer, FilterResources *shared) : cfg(config), map(map_landmarks), capture(capture_writer), capture_id(0), stage(alloc_stats::STAGE_OTHER)
+{
+	configure(pf, cfg, shared);
+
+	if (capture)
+		capture_id = capture->open_session();
+
+	if (!cfg.workers.empty())
+		distributed.reset(new DistributedFilter(cfg.workers, map));
+
+	// Checkpoints only cover an in-process particle set
+	if (cfg.latency_budget_us > 0.0 && cfg.recorder_frames && !distributed)
+		recorder.reset(new FlightRecorder(cfg.recorder_frames, cfg.latency_budget_us, cfg.recorder_dir, capture ? capture_id : recorder_sessions++));
+}
+Session::~Session()
+{
+	if (capture)
+		capture->close_session(capture_id);
+}
+std::string Session::hasData(const std::string& s)
+{
+	auto found_null = s.find("null");
+	auto b1			= s.find_first_of("[");
+	auto b2			= s.find_first_of("]");
+
+	if (found_null != std::string::npos)
+		return "";
+
+	else if (b1 != std::string::npos && b2 != std::string::npos)
+		return s.substr(b1, b2 - b1 + 1);
+
+	return "";
+}
+void Session::restore(const FilterState &state)
+{
+	pf.restore_state(state);
+}
+void Session::begin_frame(const CaptureKind &kind, const char *data, const size_t &length)
+{
+	if (capture)
+		capture->record(capture_id, kind, data, length);
+
+	if (recorder)
+		recorder->begin_frame(kind, data, length, pf);
+
+	for (unsigned int i = 0; i < alloc_stats::STAGE_COUNT; ++i)
+		stage_ns[i] = 0.0;
+
+	stage		= alloc_stats::STAGE_PARSE;
+	stage_start = Clock::now();
+}
+void Session::enter(alloc_stats::Scope &alloc_scope, const alloc_stats::Stage &next)
+{
+	const Clock::time_point now = Clock::now();
+
+	stage_ns[stage] += std::chrono::duration<double, std::nano>(now - stage_start).count();
+	stage			 = next;
+	stage_start		 = now;
+
+	alloc_scope.enter(next);
+}
+void Session::end_frame(alloc_stats::Scope &alloc_scope)
+{
+	enter(alloc_scope, alloc_stats::STAGE_OTHER);
+
+	if (recorder)
+		recorder->end_frame(stage_ns);
+}
+void Session::step(const Input &input, alloc_stats::Scope &alloc_scope)
+{
+	if (distributed)
+	{
+		step_distributed(input, alloc_scope);
+		return;
+	}
+
+	enter(alloc_scope, alloc_stats::STAGE_PREDICTION);
+
+	if (!pf.initialized())
+		pf.init(cfg.particles_numb, map.to_local_x(input.sense_x), map.to_local_y(input.sense_y), input.sense_theta, cfg.sigma_pos);
+	else 
+		pf.prediction(cfg.delta_t, cfg.sigma_pos, input.velocity, input.yaw_rate);
+
+	enter(alloc_scope, alloc_stats::STAGE_UPDATE);
+	pf.updateWeights(cfg.sensor_range, cfg.sigma_landmark, noisy_observations, map);
+
+	enter(alloc_scope, alloc_stats::STAGE_REPORT);
+	best_particle = pf.particle(pf.get_best_particle(cfg.publish_estimate ? &estimate : nullptr));
+	pf.associate(best_particle, cfg.sensor_range, noisy_observations, map);
+
+	enter(alloc_scope, alloc_stats::STAGE_RESAMPLE);
+	pf.resample();
+
+	enter(alloc_scope, alloc_stats::STAGE_REPORT);
+}
+void Session::step_distributed(const Input &input, alloc_stats::Scope &alloc_scope)
+{
+	enter(alloc_scope, alloc_stats::STAGE_PREDICTION);
+
+	if (!distributed->initialized())
+		distributed->init(cfg.particles_numb, map.to_local_x(input.sense_x), map.to_local_y(input.sense_y), input.sense_theta, cfg);
+	else
+		distributed->prediction(cfg.delta_t, input.velocity, input.yaw_rate);
+
+	enter(alloc_scope, alloc_stats::STAGE_UPDATE);
+	distributed->updateWeights(noisy_observations);
+
+	enter(alloc_scope, alloc_stats::STAGE_REPORT);
+	best_particle = distributed->get_best_particle(cfg.publish_estimate ? &estimate : nullptr);
+	pf.associate(best_particle, cfg.sensor_range, noisy_observations, map);
+
+	enter(alloc_scope, alloc_stats::STAGE_RESAMPLE);
+	distributed->resample();
+
+	enter(alloc_scope, alloc_stats::STAGE_REPORT);
+}
+bool Session::handle_message(const char *message, const size_t &length, std::string &reply)
+{
+	if (!(length && length > 2 && message[0] == '4' && message[1] == '2'))
+		return false;
+
+	begin_frame(CAPTURE_TEXT, message, length);
+	alloc_stats::Scope alloc_scope(alloc_stats::STAGE_PARSE);
+
+	const bool replied = process_message(message, length, reply, alloc_scope);
+
+	end_frame(alloc_scope);
+	return replied;
+}
+bool Session::process_message(const char *message, const size_t &length, std::string &reply, alloc_stats::Scope &alloc_scope)
+{
+	auto s = hasData(std::string(message, length));	
+	if (s == "")
+	{
+		reply = "42[\"manual\",{}]";
+		return true;
+	}
+
+	auto j = nlohmann::json::parse(s);
+	if (j[0].get<std::string>() != "telemetry")
+		return false;
+
+	// All five fields, step() picks by the state of whichever filter runs, local or sharded
+	Input input = Input();
+	input.sense_x	  = std::stod(j[1]["sense_x"].		   get<std::string>());
+	input.sense_y	  = std::stod(j[1]["sense_y"].		   get<std::string>());
+	input.sense_theta = std::stod(j[1]["sense_theta"].	   get<std::string>());
+	input.velocity	  = std::stod(j[1]["previous_velocity"].get<std::string>());
+	input.yaw_rate	  = std::stod(j[1]["previous_yawrate"]. get<std::string>());
+
+	const std::string		&sense_observations_x = j[1]["sense_observations_x"].get_ref<const std::string&>();
+	const std::string		&sense_observations_y = j[1]["sense_observations_y"].get_ref<const std::string&>();
+
+	String2Floats()(sense_observations_x, x_sense);
+	String2Floats()(sense_observations_y, y_sense);
+
+	const unsigned int obs_numb = std::min(x_sense.size(), y_sense.size());
+	noisy_observations.resize(obs_numb);
+	
+	for (unsigned int i = 0; i < obs_numb; ++i)
+		noisy_observations[i] = LandmarkObs(x_sense[i], y_sense[i], 0);
+
+	step(input, alloc_scope);
+
+	nlohmann::json msgJson;
+	msgJson["best_particle_x"]			  = map.to_global_x(best_particle.x);
+	msgJson["best_particle_y"]			  = map.to_global_y(best_particle.y);
+	msgJson["best_particle_theta"]		  = best_particle.theta;
+	msgJson["best_particle_associations"] = pf.getAssociations();
+	msgJson["best_particle_sense_x"]	  = pf.getSenseX();
+	msgJson["best_particle_sense_y"]	  = pf.getSenseY();
+
+	if (cfg.publish_estimate)
+	{
+		msgJson["mean_x"]				  = map.to_global_x(estimate.x);
+		msgJson["mean_y"]				  = map.to_global_y(estimate.y);
+		msgJson["mean_theta"]			  = estimate.theta;
+		msgJson["covariance"]			  = std::vector<double>(estimate.cov, estimate.cov + 9);
+	}
+
+	reply = "42[\"best_particle\"," + msgJson.dump() + "]";
+	return true;
+}
+void Session::handle_frame(const TelemetryFrame &frame, PoseFrame &result)
+{
+	const size_t encoded_size = capture || recorder ? encode_telemetry(frame, encoded) : 0;
+
+	begin_frame(CAPTURE_FRAME, encoded, encoded_size);
+	alloc_stats::Scope alloc_scope(alloc_stats::STAGE_PARSE);
+
+	const Input input = { frame.sense_x, frame.sense_y, frame.sense_theta, frame.previous_velocity, frame.previous_yawrate };
+
+	const unsigned int obs_numb = std::min(frame.obs_numb, TELEMETRY_MAX_OBSERVATIONS);
+	noisy_observations.resize(obs_numb);
+
+	for (unsigned int i = 0; i < obs_numb; ++i)
+		noisy_observations[i] = LandmarkObs(frame.obs_x[i], frame.obs_y[i], 0);
+
+	step(input, alloc_scope);
+
+	result.seq			= frame.seq;
+	result.sent_ns		= frame.sent_ns;
+	result.best_x		= map.to_global_x(best_particle.x);
+	result.best_y		= map.to_global_y(best_particle.y);
+	result.best_theta	= best_particle.theta;
+	result.mean_x		= cfg.publish_estimate ? map.to_global_x(estimate.x) : result.best_x;
+	result.mean_y		= cfg.publish_estimate ? map.to_global_y(estimate.y) : result.best_y;
+	result.mean_theta	= cfg.publish_estimate ? estimate.theta				 : result.best_theta;
+
+	for (unsigned int i = 0; i < 9; ++i)
+		result.covariance[i] = cfg.publish_estimate ? estimate.cov[i] : 0.0;
+
+	end_frame(alloc_scope);
+}
@@ -0,0 +1,154 @@
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "particle_filter.h"
+#include "alloc_stats.h"
+#include "telemetry.h"
+#include "capture.h"
+#include "flight_recorder.h"
+
+class DistributedFilter;
+
+/*
+ * Filter settings shared by every session, read from cfg.txt by Master.
+ */
+struct FilterConfig
+{
+	FilterConfig() : delta_t(0.0), sensor_range(0.0), particles_numb(0), association(ASSOCIATION_BRUTE_FORCE), resampler(RESAMPLER_SYSTEMATIC), resampler_iterations(32), sort_interval(0), bucket_size(0.0), cache_margin(0.0), multiplicity(false), threads_numb(1), numa(false), publish_estimate(false),
+					 islands_numb(1), migration_interval(5), migration_rate(0.05), recorder_frames(64), latency_budget_us(0.0), recorder_dir(".") {}
+	/**
+	 * set Applies one cfg.txt entry.
+	 * @output False if key is not a filter setting
+	 */
+	bool set(const std::string &key, const std::string &value);
+
+	double						delta_t;				// Time elapsed between measurements [sec]
+	double						sensor_range;			// Sensor range [m]
+	unsigned int				particles_numb;
+
+	std::vector<double>			sigma_pos;				// GPS measurement uncertainty [x [m], y [m], theta [rad]]
+	std::vector<double>			sigma_landmark;			// Landmark measurement uncertainty [x [m], y [m]]
+
+	AssociationType				association;			// Landmark range query engine
+	ResamplerType				resampler;				// Ancestor draws of the resampling step
+	unsigned int				resampler_iterations;	// Metropolis steps per particle, or rejection proposal cap
+	unsigned int				sort_interval;			// Resamples between Hilbert curve sorts of the particles, 0 disables
+	double						bucket_size;			// Grid cell [m] sharing one landmark query between its particles, 0 disables
+	double						cache_margin;			// Slack [m] of the landmark query kept across frames per particle chunk, 0 disables
+	bool						multiplicity;			// Keep resampled duplicates as one particle and a copy count until prediction
+	unsigned int				threads_numb;			// Filter threads, 0 uses all hardware threads
+	bool						numa;					// Pin the filter threads per NUMA node, particle chunks are first-touched by their threads
+	bool						publish_estimate;		// Publish weighted mean pose and covariance
+
+	unsigned int				islands_numb;			// Independently resampled particle islands, 1 keeps one global set
+	unsigned int				migration_interval;		// Frames between island migrations, 0 disables
+	double						migration_rate;			// Fraction of an island migrating to the next one
+
+	std::vector<std::string>	workers;				// host:port of pf_worker processes sharding the particles, empty runs in-process
+
+	unsigned int				recorder_frames;		// Flight recorder checkpoint interval K, dumps hold K to 2K frames
+	double						latency_budget_us;		// Frames slower than this are dumped by the flight recorder, 0 disables
+	std::string					recorder_dir;			// Directory flight recorder dumps are written to
+};
+
+/*
+ * What the sessions of a process share: one thread pool rather than one per vehicle, and one
+ * association engine built over the common map rather than one per vehicle.
+ */
+struct FilterResources
+{
+	FilterResources(const FilterConfig &config, const Map &map);
+
+	ThreadPool							pool;
+	std::shared_ptr<AssociationEngine>	association;
+};
+
+/**
+ * configure Applies the filter settings of cfg to pf. Sessions, pf_worker shards and pf_bench
+ *   all set their filters up here, so a new setting is wired in once.
+ * @param shared Optional pool and engine to use instead of the filter's own
+ */
+void configure(ParticleFilter &pf, const FilterConfig &cfg, FilterResources *shared = nullptr);
+
+/*
+ * One localized vehicle: its particle filter and the parse -> filter -> serialize
+ * pipeline, independent of the transport the frames arrive on.
+ */
+class Session
+{
+public:
+	/**
+	 * Session
+	 * @param capture Optional capture every received frame is recorded to
+	 * @param shared Optional pool and engine shared with the other sessions, for map
+	 */
+	Session(const FilterConfig &config, const Map &map, CaptureWriter *capture = nullptr, FilterResources *shared = nullptr);
+	~Session();
+	/**
+	 * handle_message Processes one socket.io text message from the simulator.
+	 * @param reply Text message to send back
+	 * @output False if the message needs no reply
+	 */
+	bool handle_message	(const char *message, const size_t &length, std::string &reply);
+	/**
+	 * handle_frame Processes one binary telemetry frame.
+	 */
+	void handle_frame	(const TelemetryFrame &frame, PoseFrame &result);
+	/**
+	 * restore Continues from a filter checkpoint, used to replay flight recorder dumps.
+	 */
+	void restore		(const FilterState &state);
+
+	const ParticleFilter& filter() const { return pf; }
+private:
+	struct Input
+	{
+		double					sense_x;
+		double					sense_y;
+		double					sense_theta;
+		double					velocity;
+		double					yaw_rate;
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	static std::string hasData	(const std::string &s);
+	bool process_message		(const char *message, const size_t &length, std::string &reply, alloc_stats::Scope &alloc_scope);
+
+	// Frame bookkeeping: capture, flight recorder and per-stage timing
+	void begin_frame			(const CaptureKind &kind, const char *data, const size_t &length);
+	void enter					(alloc_stats::Scope &alloc_scope, const alloc_stats::Stage &next);
+	void end_frame				(alloc_stats::Scope &alloc_scope);
+	// Runs one frame on noisy_observations, leaving the results in best_particle and estimate
+	void step					(const Input &input, alloc_stats::Scope &alloc_scope);
+	void step_distributed		(const Input &input, alloc_stats::Scope &alloc_scope);
+
+	const FilterConfig			&cfg;
+	const Map					&map;
+	ParticleFilter				pf;
+
+	// Set when the particles live on pf_worker processes, pf then only associates the reported particle
+	std::unique_ptr<DistributedFilter> distributed;
+
+	// Per-message scratch buffers, reused so steady state messages do not reallocate them
+	std::vector<float>			x_sense;
+	std::vector<float>			y_sense;
+	std::vector<LandmarkObs>	noisy_observations;
+
+	Particle					best_particle;
+	PoseEstimate				estimate;
+
+	CaptureWriter				*capture;
+	uint32_t					capture_id;
+	char						encoded[TELEMETRY_MAX_PAYLOAD];
+
+	std::unique_ptr<FlightRecorder> recorder;
+	alloc_stats::Stage			stage;
+	Clock::time_point			stage_start;
+	double						stage_ns[alloc_stats::STAGE_COUNT];
+};
+
+#endif /* __SESSION_H__ */
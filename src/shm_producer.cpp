@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include "helper_functions.h"
+#include "shm_ring.h"
+#include "telemetry.h"
+
+/*
+ * Local test producer for the shared memory transport. Drives a simulated vehicle
+ * in circles over the map, sends one telemetry frame at a time and reports the round-trip
+ * latency percentiles and the pose error of the returned best particle.
+ * Usage: shm_producer [shm_name] [frames] [map_path]
+ */
+namespace
+{
+	uint64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	double percentile(const std::vector<double> &sorted, const double &p)
+	{
+		return sorted[std::min<size_t>(sorted.size() - 1, size_t(p * sorted.size()))];
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const std::string	shm_name	= argc > 1 ? argv[1] : "/pf_telemetry";
+	const unsigned int	frames_numb	= argc > 2 ? std::atoi(argv[2]) : 2000;
+	const std::string	map_path	= argc > 3 ? argv[3] : "../data/map_data.txt";
+
+	const double		sensor_range = 50.0;
+	const double		delta_t		 = 0.1;
+	const double		velocity	 = 10.0;
+	const double		radius		 = 20.0;
+	const double		yaw_rate	 = velocity / radius;
+
+	Map map;
+	if (!read_map_data(map_path, map))
+	{
+		std::cerr << "Error: Could not open map file " << map_path << std::endl;
+		return 1;
+	}
+
+	ShmRing<TelemetryFrame> requests;
+	ShmRing<PoseFrame>		responses;
+
+	if (!requests.open(shm_name + "_req") || !responses.open(shm_name + "_rsp"))
+	{
+		std::cerr << "Error: Could not open shared memory rings " << shm_name << "_req/_rsp (is the server running with SHM_NAME " << shm_name << "?)" << std::endl;
+		return 1;
+	}
+
+	std::mt19937						gen(7);
+	std::normal_distribution<double>	gps_noise(0.0, 0.3);
+	std::normal_distribution<double>	obs_noise(0.0, 0.3);
+
+	std::unique_ptr<TelemetryFrame>		frame(new TelemetryFrame());
+	PoseFrame							pose;
+	std::vector<double>					latency_us;
+	latency_us.reserve(frames_numb);
+
+	// Laps around the centre of the map so the landmarks stay in view
+	double x = map.origin_x, y = map.origin_y - radius, theta = 0.0, error_sum = 0.0;
+
+	for (unsigned int f = 0; f < frames_numb; ++f)
+	{
+		if (f)
+		{
+			x	  += velocity / yaw_rate * (std::sin(theta + yaw_rate * delta_t) - std::sin(theta));
+			y	  += velocity / yaw_rate * (std::cos(theta) - std::cos(theta + yaw_rate * delta_t));
+			theta += yaw_rate * delta_t;
+		}
+
+		frame->seq				 = f;
+		frame->flags			 = f == 0 ? TELEMETRY_RESET : 0;
+		frame->sense_x			 = x + gps_noise(gen);
+		frame->sense_y			 = y + gps_noise(gen);
+		frame->sense_theta		 = theta;
+		frame->previous_velocity = velocity;
+		frame->previous_yawrate	 = yaw_rate;
+		frame->obs_numb			 = 0;
+
+		for (unsigned int i = 0; i < map.landmark_list.size() && frame->obs_numb < TELEMETRY_MAX_OBSERVATIONS; ++i)
+		{
+			const double dx = map.to_global_x(map.landmark_list[i].x_f) - x;
+			const double dy = map.to_global_y(map.landmark_list[i].y_f) - y;
+
+			if (dx * dx + dy * dy > sensor_range * sensor_range)
+				continue;
+
+			frame->obs_x[frame->obs_numb]	= dx * std::cos(theta) + dy * std::sin(theta)  + obs_noise(gen);
+			frame->obs_y[frame->obs_numb++] = -dx * std::sin(theta) + dy * std::cos(theta) + obs_noise(gen);
+		}
+
+		frame->sent_ns = now_ns();
+		requests.push(*frame);
+
+		do
+		{
+			if (!responses.pop(pose, 1000))
+			{
+				std::cerr << "Error: No response for frame " << f << std::endl;
+				return 1;
+			}
+		} while (pose.seq != f);
+
+		latency_us.push_back((now_ns() - pose.sent_ns) * 1e-3);
+
+		const std::vector<double> error = getError(x, y, theta, pose.best_x, pose.best_y, pose.best_theta);
+		error_sum += std::sqrt(error[0] * error[0] + error[1] * error[1]);
+	}
+
+	std::sort(latency_us.begin(), latency_us.end());
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "frames          = " << frames_numb << std::endl;
+	std::cout << "round trip [us] = p50 " << percentile(latency_us, 0.5) << "  p90 " << percentile(latency_us, 0.9)
+			  << "  p99 " << percentile(latency_us, 0.99) << "  max " << latency_us.back() << std::endl;
+	std::cout << std::setprecision(3);
+	std::cout << "mean xy error   = " << error_sum / frames_numb << " m" << std::endl;
+
+	return 0;
+}
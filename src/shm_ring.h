@@ -0,0 +1,218 @@
+#ifndef __SHM_RING_H__
+#define __SHM_RING_H__
+
+#include <atomic>
+#include <string>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Single producer / single consumer ring of fixed-size POD slots in POSIX shared memory.
+ * The consumer spins briefly on an empty ring and then sleeps on a futex on the head
+ * index; the producer only pays for the wake-up syscall while the consumer is asleep.
+ */
+template<typename T>
+class ShmRing
+{
+	static_assert(std::is_trivially_copyable<T>::value, "ShmRing slots are copied with memcpy");
+
+	static const uint32_t	MAGIC		= 0x50465231;	// "PFR1"
+	static const unsigned	SPIN_COUNT	= 2000;			// Empty polls before sleeping on the futex
+
+	struct Header
+	{
+		alignas(64) std::atomic<uint32_t>	head;		// Slots pushed, written by the producer only
+		alignas(64) std::atomic<uint32_t>	tail;		// Slots popped, written by the consumer only
+		alignas(64) std::atomic<uint32_t>	waiters;	// Consumers sleeping on head
+		uint32_t							magic;
+		uint32_t							slot_size;
+		uint32_t							capacity;	// Power of two
+	};
+public:
+	ShmRing() : header(nullptr), slots(nullptr), bytes(0), mask(0), owner(false) {}
+	~ShmRing() { close(); }
+
+	ShmRing(const ShmRing&)			   = delete;
+	ShmRing& operator=(const ShmRing&) = delete;
+	/**
+	 * create Creates (or recreates) the shared memory object and maps it.
+	 * @param name POSIX shm name, "/name"
+	 * @param capacity Number of slots, rounded up to a power of two
+	 */
+	bool create(const std::string &shm_name, const unsigned int &capacity)
+	{
+		close();
+
+		uint32_t slots_numb = 1;
+		while (slots_numb < capacity)
+			slots_numb <<= 1;
+
+		shm_unlink(shm_name.c_str());
+		const int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0)
+			return false;
+
+		const size_t size = sizeof(Header) + size_t(slots_numb) * sizeof(T);
+		if (ftruncate(fd, size) != 0 || !map_fd(fd, size))
+		{
+			::close(fd);
+			shm_unlink(shm_name.c_str());
+			return false;
+		}
+		::close(fd);
+
+		header->head.store(0);
+		header->tail.store(0);
+		header->waiters.store(0);
+		header->slot_size	= sizeof(T);
+		header->capacity	= slots_numb;
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic		= MAGIC;
+
+		mask  = slots_numb - 1;
+		name  = shm_name;
+		owner = true;
+		return true;
+	}
+	/**
+	 * open Maps a ring created by another process. Fails if the slot layout does not match.
+	 */
+	bool open(const std::string &shm_name)
+	{
+		close();
+
+		const int fd = shm_open(shm_name.c_str(), O_RDWR, 0600);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		const bool mapped = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(Header) && map_fd(fd, st.st_size);
+		::close(fd);
+
+		if (!mapped)
+			return false;
+
+		if (header->magic != MAGIC || header->slot_size != sizeof(T) || sizeof(Header) + size_t(header->capacity) * sizeof(T) > bytes)
+		{
+			close();
+			return false;
+		}
+		mask = header->capacity - 1;
+		name = shm_name;
+		return true;
+	}
+	// Unmaps the ring, the creator also unlinks it
+	void close()
+	{
+		if (header)
+			munmap(header, bytes);
+
+		if (owner)
+			shm_unlink(name.c_str());
+
+		header = nullptr;
+		slots  = nullptr;
+		bytes  = 0;
+		owner  = false;
+	}
+
+	bool is_open() const { return header != nullptr; }
+	/**
+	 * try_push Copies item into the ring.
+	 * @output False if the ring is full
+	 */
+	bool try_push(const T &item)
+	{
+		const uint32_t head = header->head.load(std::memory_order_relaxed);
+
+		if (head - header->tail.load(std::memory_order_acquire) > mask)
+			return false;
+
+		std::memcpy(&slots[head & mask], &item, sizeof(T));
+		header->head.store(head + 1, std::memory_order_seq_cst);
+
+		// Pairs with the waiters increment in pop(): either the consumer sees the new head or we see it waiting
+		if (header->waiters.load(std::memory_order_seq_cst))
+			futex(&header->head, FUTEX_WAKE, 1, nullptr);
+
+		return true;
+	}
+	// Pushes item, yielding while the ring is full
+	void push(const T &item)
+	{
+		while (!try_push(item))
+			std::this_thread::yield();
+	}
+	/**
+	 * try_pop Copies the oldest item out of the ring.
+	 * @output False if the ring is empty
+	 */
+	bool try_pop(T &item)
+	{
+		const uint32_t tail = header->tail.load(std::memory_order_relaxed);
+
+		if (header->head.load(std::memory_order_acquire) == tail)
+			return false;
+
+		std::memcpy(&item, &slots[tail & mask], sizeof(T));
+		header->tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+	/**
+	 * pop Waits up to timeout_ms for an item, spinning first and then sleeping on the futex.
+	 * @output False on timeout
+	 */
+	bool pop(T &item, const unsigned int &timeout_ms)
+	{
+		for (unsigned int i = 0; i < SPIN_COUNT; ++i)
+			if (try_pop(item))
+				return true;
+
+		const struct timespec timeout = { time_t(timeout_ms / 1000), long(timeout_ms % 1000) * 1000000L };
+		const uint32_t		  tail	  = header->tail.load(std::memory_order_relaxed);
+
+		header->waiters.fetch_add(1, std::memory_order_seq_cst);
+		if (header->head.load(std::memory_order_seq_cst) == tail)
+			futex(&header->head, FUTEX_WAIT, tail, &timeout);
+		header->waiters.fetch_sub(1, std::memory_order_relaxed);
+
+		return try_pop(item);
+	}
+private:
+	bool map_fd(const int &fd, const size_t &size)
+	{
+		void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED)
+			return false;
+
+		header = static_cast<Header*>(p);
+		slots  = reinterpret_cast<T*>(static_cast<char*>(p) + sizeof(Header));
+		bytes  = size;
+		return true;
+	}
+	// Shared (not FUTEX_PRIVATE) operations, the word lives in memory mapped by two processes
+	static long futex(std::atomic<uint32_t> *word, const int &op, const uint32_t &value, const struct timespec *timeout)
+	{
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit integer");
+		return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+	}
+
+	Header				*header;
+	T					*slots;
+	size_t				bytes;
+	uint32_t			mask;
+	bool				owner;
+	std::string			name;
+};
+
+#endif /* __SHM_RING_H__ */
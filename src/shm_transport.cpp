@@ -0,0 +1,54 @@
+#include "shm_transport.h"
+
+ShmTransport::ShmTransport(const FilterConfig &config, const Map &map_landmarks, CaptureWriter *capture_writer, FilterResources *shared_resources) : cfg(config), map(map_landmarks), capture(capture_writer), shared(shared_resources), running(false) {}
+
+ShmTransport::~ShmTransport()
+{
+	stop();
+}
+bool ShmTransport::start(const std::string &name, const unsigned int &capacity)
+{
+	stop();
+
+	if (!requests.create(name + "_req", capacity) || !responses.create(name + "_rsp", capacity))
+	{
+		requests.close();
+		responses.close();
+		return false;
+	}
+
+	running = true;
+	worker	= std::thread(&ShmTransport::serve, this);
+	return true;
+}
+void ShmTransport::stop()
+{
+	running = false;
+
+	if (worker.joinable())
+		worker.join();
+
+	requests.close();
+	responses.close();
+}
+void ShmTransport::serve()
+{
+	// Frames are a few kB, keep them off the stack of the hot loop
+	std::unique_ptr<TelemetryFrame> frame(new TelemetryFrame());
+	std::unique_ptr<PoseFrame>		pose (new PoseFrame());
+
+	while (running)
+	{
+		// The timeout only bounds how long stop() waits for an idle ring
+		if (!requests.pop(*frame, 100))
+			continue;
+
+		if (!session || (frame->flags & TELEMETRY_RESET))
+			session.reset(new Session(cfg, map, capture, shared));
+
+		session->handle_frame(*frame, *pose);
+		// A producer that stopped reading must not wedge stop()
+		while (!responses.try_push(*pose) && running)
+			std::this_thread::yield();
+	}
+}
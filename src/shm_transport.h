@@ -0,0 +1,48 @@
+#ifndef __SHM_TRANSPORT_H__
+#define __SHM_TRANSPORT_H__
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include "session.h"
+#include "shm_ring.h"
+
+/*
+ * Shared memory transport for co-located producers. Telemetry frames arrive on the
+ * "<name>_req" ring and pose frames go back on "<name>_rsp", served by a dedicated
+ * thread with its own Session.
+ */
+class ShmTransport
+{
+public:
+	/**
+	 * ShmTransport
+	 * @param shared Optional pool and engine the sessions share with the other transports
+	 */
+	ShmTransport(const FilterConfig &config, const Map &map, CaptureWriter *capture = nullptr, FilterResources *shared = nullptr);
+	~ShmTransport();
+	/**
+	 * start Creates both rings and starts the serving thread.
+	 * @param name POSIX shm name prefix, "/name"
+	 * @param capacity Slots per ring
+	 */
+	bool start	(const std::string &name, const unsigned int &capacity);
+
+	void stop	();
+private:
+	void serve	();
+
+	const FilterConfig				&cfg;
+	const Map						&map;
+	CaptureWriter					*capture;
+	FilterResources					*shared;
+
+	ShmRing<TelemetryFrame>			requests;
+	ShmRing<PoseFrame>				responses;
+	std::unique_ptr<Session>		session;
+
+	std::thread						worker;
+	std::atomic<bool>				running;
+};
+
+#endif /* __SHM_TRANSPORT_H__ */
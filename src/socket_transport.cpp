@@ -0,0 +1,321 @@
+#include "socket_transport.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+namespace
+{
+	const size_t		READ_SIZE	= 64 * 1024;
+	const unsigned int	MAX_EVENTS	= 64;
+	const size_t		MAX_PENDING	= 16 * 1024 * 1024;	// Queued reply bytes before a client that does not read is dropped
+
+	int bind_listener(const int &domain, const sockaddr *addr, const socklen_t &addr_len)
+	{
+		const int fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+
+		const int on = 1;
+		if (domain == AF_INET)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		if (bind(fd, addr, addr_len) != 0 || listen(fd, SOMAXCONN) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+}
+
+SocketTransport::SocketTransport(const FilterConfig &config, const Map &map_landmarks, CaptureWriter *capture_writer, FilterResources *shared_resources) : cfg(config), map(map_landmarks), capture(capture_writer), shared(shared_resources), epoll_fd(-1), wake_fd(-1), spill(READ_SIZE), frame(new TelemetryFrame()), running(false) {}
+
+SocketTransport::~SocketTransport()
+{
+	stop();
+
+	for (unsigned int i = 0; i < listeners.size(); ++i)
+		close(listeners[i]);
+
+	if (!unix_path.empty())
+		unlink(unix_path.c_str());
+}
+bool SocketTransport::listen_unix(const std::string &path)
+{
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+
+	std::strcpy(addr.sun_path, path.c_str());
+	unlink(path.c_str());
+
+	const int fd = bind_listener(AF_UNIX, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+	if (fd < 0)
+		return false;
+
+	listeners.push_back(fd);
+	unix_path = path;
+	return true;
+}
+bool SocketTransport::listen_tcp(const unsigned int &port)
+{
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family		 = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port		 = htons(port);
+
+	const int fd = bind_listener(AF_INET, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
+	if (fd < 0)
+		return false;
+
+	listeners.push_back(fd);
+	return true;
+}
+bool SocketTransport::start()
+{
+	stop();
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wake_fd	 = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (epoll_fd < 0 || wake_fd < 0)
+	{
+		stop();
+		return false;
+	}
+
+	epoll_event ev;
+	ev.events  = EPOLLIN;
+	ev.data.fd = wake_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+	for (unsigned int i = 0; i < listeners.size(); ++i)
+	{
+		ev.data.fd = listeners[i];
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listeners[i], &ev);
+	}
+
+	running = true;
+	worker	= std::thread(&SocketTransport::serve, this);
+	return true;
+}
+void SocketTransport::stop()
+{
+	if (worker.joinable())
+	{
+		running = false;
+
+		const uint64_t one = 1;
+		if (write(wake_fd, &one, sizeof(one)) < 0)
+			std::cerr << "Failed to wake the socket transport: " << std::strerror(errno) << std::endl;
+
+		worker.join();
+	}
+
+	while (!connections.empty())
+		close_connection(connections.begin()->first);
+
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+
+	if (wake_fd >= 0)
+		close(wake_fd);
+
+	epoll_fd = wake_fd = -1;
+}
+void SocketTransport::serve()
+{
+	epoll_event events[MAX_EVENTS];
+
+	while (running)
+	{
+		const int events_numb = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+
+		for (int i = 0; i < events_numb && running; ++i)
+		{
+			const int fd = events[i].data.fd;
+
+			if (fd == wake_fd)
+				continue;
+
+			if (std::find(listeners.begin(), listeners.end(), fd) != listeners.end())
+			{
+				accept_connections(fd);
+				continue;
+			}
+
+			auto it = connections.find(fd);
+			if (it == connections.end())
+				continue;
+
+			Connection &connection = *it->second;
+			bool		keep	   = !(events[i].events & (EPOLLERR | EPOLLHUP)) || (events[i].events & EPOLLIN);
+
+			if (keep && (events[i].events & EPOLLIN))
+				keep = read_connection(connection);
+
+			if (keep && (events[i].events & EPOLLOUT))
+				keep = flush(connection);
+
+			if (!keep)
+				close_connection(fd);
+		}
+	}
+}
+void SocketTransport::accept_connections(const int &listen_fd)
+{
+	for (;;)
+	{
+		const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		// Replies are small and latency bound, do not let Nagle hold them back
+		const int on = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+		std::unique_ptr<Connection> connection(new Connection());
+		connection->fd = fd;
+		connection->session.reset(new Session(cfg, map, capture, shared));
+		connection->in.resize(READ_SIZE);
+
+		epoll_event ev;
+		ev.events  = EPOLLIN;
+		ev.data.fd = fd;
+
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		connections[fd] = std::move(connection);
+	}
+}
+bool SocketTransport::read_connection(Connection &connection)
+{
+	// One readv per wake-up: whatever does not fit the connection buffer lands in spill,
+	// so a burst of frames is drained by a single syscall
+	iovec iov[2];
+	iov[0].iov_base = connection.in.data() + connection.in_used;
+	iov[0].iov_len	= connection.in.size() - connection.in_used;
+	iov[1].iov_base = spill.data();
+	iov[1].iov_len	= spill.size();
+
+	const ssize_t bytes = readv(connection.fd, iov, 2);
+
+	if (bytes == 0)
+		return false;
+
+	if (bytes < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+	if (size_t(bytes) > iov[0].iov_len)
+	{
+		const size_t spilled = bytes - iov[0].iov_len;
+		connection.in.resize(connection.in.size() + spilled);
+		std::memcpy(connection.in.data() + connection.in.size() - spilled, spill.data(), spilled);
+		connection.in_used = connection.in.size();
+	}
+	else
+		connection.in_used += bytes;
+
+	return process_frames(connection) && flush(connection) && connection.out.size() - connection.out_sent <= MAX_PENDING;
+}
+bool SocketTransport::process_frames(Connection &connection)
+{
+	size_t offset = 0;
+
+	while (connection.in_used - offset >= sizeof(uint32_t))
+	{
+		uint32_t length;
+		std::memcpy(&length, connection.in.data() + offset, sizeof(length));
+
+		if (length > TELEMETRY_MAX_PAYLOAD)
+			return false;
+
+		if (connection.in_used - offset < sizeof(length) + length)
+			break;
+
+		if (!decode_telemetry(connection.in.data() + offset + sizeof(length), length, *frame))
+			return false;
+
+		offset += sizeof(length) + length;
+
+		if (frame->flags & TELEMETRY_RESET)
+			connection.session.reset(new Session(cfg, map, capture, shared));
+
+		connection.session->handle_frame(*frame, pose);
+
+		const uint32_t reply_length = sizeof(pose);
+		const size_t   out_size		= connection.out.size();
+		connection.out.resize(out_size + sizeof(reply_length) + sizeof(pose));
+		std::memcpy(connection.out.data() + out_size,						 &reply_length, sizeof(reply_length));
+		std::memcpy(connection.out.data() + out_size + sizeof(reply_length), &pose,			sizeof(pose));
+	}
+
+	// Keep the partial frame at the front; the buffer shrinks back after a spill
+	std::memmove(connection.in.data(), connection.in.data() + offset, connection.in_used - offset);
+	connection.in_used -= offset;
+
+	if (connection.in.size() > READ_SIZE && connection.in_used <= READ_SIZE)
+		connection.in.resize(READ_SIZE);
+
+	return true;
+}
+bool SocketTransport::flush(Connection &connection)
+{
+	while (connection.out_sent < connection.out.size())
+	{
+		const ssize_t bytes = send(connection.fd, connection.out.data() + connection.out_sent, connection.out.size() - connection.out_sent, MSG_NOSIGNAL);
+
+		if (bytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+			break;
+		}
+		connection.out_sent += bytes;
+	}
+
+	const bool pending = connection.out_sent < connection.out.size();
+
+	if (!pending)
+	{
+		connection.out.clear();
+		connection.out_sent = 0;
+	}
+
+	// Only poll for writability while replies are queued
+	if (pending != connection.want_write)
+	{
+		epoll_event ev;
+		ev.events  = EPOLLIN | (pending ? EPOLLOUT : 0);
+		ev.data.fd = connection.fd;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &ev);
+
+		connection.want_write = pending;
+	}
+	return true;
+}
+void SocketTransport::close_connection(const int &fd)
+{
+	if (epoll_fd >= 0)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+	close(fd);
+	connections.erase(fd);
+}
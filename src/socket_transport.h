@@ -0,0 +1,81 @@
+#ifndef __SOCKET_TRANSPORT_H__
+#define __SOCKET_TRANSPORT_H__
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include "session.h"
+
+/*
+ * Unix domain and plain TCP transports speaking the length-prefixed binary framing of
+ * telemetry.h. A single epoll thread serves every connection; each connection owns a
+ * Session, and all complete frames of one read are answered with a single send.
+ */
+class SocketTransport
+{
+public:
+	/**
+	 * SocketTransport
+	 * @param shared Optional pool and engine the sessions share with the other transports
+	 */
+	SocketTransport(const FilterConfig &config, const Map &map, CaptureWriter *capture = nullptr, FilterResources *shared = nullptr);
+	~SocketTransport();
+	/**
+	 * listen_unix Binds a Unix domain stream socket, replacing a stale socket file.
+	 */
+	bool listen_unix	(const std::string &path);
+	/**
+	 * listen_tcp Binds a TCP socket on all interfaces.
+	 */
+	bool listen_tcp		(const unsigned int &port);
+	/**
+	 * start Starts the epoll thread serving the listeners bound so far.
+	 */
+	bool start			();
+
+	void stop			();
+private:
+	struct Connection
+	{
+		Connection() : fd(-1), in_used(0), out_sent(0), want_write(false) {}
+
+		int							fd;
+		std::unique_ptr<Session>	session;
+
+		std::vector<char>			in;				// Received bytes, in_used of them valid
+		size_t						in_used;
+		std::vector<char>			out;			// Pending replies, sent up to out_sent
+		size_t						out_sent;
+		bool						want_write;		// Registered for EPOLLOUT
+	};
+
+	void serve				();
+	void accept_connections	(const int &listen_fd);
+	// Reads and answers whatever is available, false if the connection must be closed
+	bool read_connection	(Connection &connection);
+	bool process_frames		(Connection &connection);
+	bool flush				(Connection &connection);
+	void close_connection	(const int &fd);
+
+	const FilterConfig			&cfg;
+	const Map					&map;
+	CaptureWriter				*capture;
+	FilterResources				*shared;
+
+	int							epoll_fd;
+	int							wake_fd;			// eventfd used by stop()
+	std::vector<int>			listeners;
+	std::string					unix_path;
+
+	std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+	std::vector<char>			spill;				// Second readv buffer, catches reads larger than a connection's free space
+	std::unique_ptr<TelemetryFrame> frame;
+	PoseFrame					pose;
+
+	std::thread					worker;
+	std::atomic<bool>			running;
+};
+
+#endif /* __SOCKET_TRANSPORT_H__ */
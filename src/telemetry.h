@@ -0,0 +1,87 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Fixed-size binary frames exchanged by the non-websocket transports. Plain old
+ * data only, so they can be copied into shared memory or onto a socket as is.
+ */
+static const unsigned int TELEMETRY_MAX_OBSERVATIONS = 128;
+static const uint32_t	   TELEMETRY_RESET			  = 1;		// Flag: (re)initialize the session from the GPS pose
+
+struct TelemetryFrame
+{
+	uint64_t	seq;						// Sequence number, echoed in the PoseFrame
+	uint64_t	sent_ns;					// Producer timestamp (CLOCK_MONOTONIC), echoed for latency measurements
+	double		sense_x;					// GPS pose, only used by the first (or a TELEMETRY_RESET) frame [m, m, rad]
+	double		sense_y;
+	double		sense_theta;
+	double		previous_velocity;			// Control since the previous frame [m/s]
+	double		previous_yawrate;			// [rad/s]
+	uint32_t	obs_numb;					// Valid entries in obs_x/obs_y
+	uint32_t	flags;						// TELEMETRY_* flags
+	float		obs_x[TELEMETRY_MAX_OBSERVATIONS];	// Observations in vehicle coordinates [m]
+	float		obs_y[TELEMETRY_MAX_OBSERVATIONS];
+};
+
+struct PoseFrame
+{
+	uint64_t	seq;
+	uint64_t	sent_ns;
+	double		best_x;						// Highest weight particle, global coordinates
+	double		best_y;
+	double		best_theta;
+	double		mean_x;						// Weighted mean pose
+	double		mean_y;
+	double		mean_theta;
+	double		covariance[9];				// Row-major 3x3 covariance of (x, y, theta)
+};
+
+/*
+ * Wire format of the socket transports: every message is a uint32 payload length
+ * followed by the payload, all in host byte order. A telemetry payload is the
+ * TelemetryFrame fields up to obs_x, then obs_numb x and obs_numb y floats; a pose
+ * payload is a PoseFrame as is.
+ */
+static const size_t TELEMETRY_HEADER_SIZE = offsetof(TelemetryFrame, obs_x);
+static const size_t TELEMETRY_MAX_PAYLOAD = TELEMETRY_HEADER_SIZE + 2 * sizeof(float) * TELEMETRY_MAX_OBSERVATIONS;
+
+/**
+ * encode_telemetry Serializes frame into payload, which must hold TELEMETRY_MAX_PAYLOAD bytes.
+ * @output Payload size
+ */
+inline size_t encode_telemetry(const TelemetryFrame &frame, char *payload)
+{
+	const uint32_t obs_numb = std::min(frame.obs_numb, uint32_t(TELEMETRY_MAX_OBSERVATIONS));
+
+	std::memcpy(payload, &frame, TELEMETRY_HEADER_SIZE);
+	std::memcpy(payload + offsetof(TelemetryFrame, obs_numb), &obs_numb, sizeof(obs_numb));
+	std::memcpy(payload + TELEMETRY_HEADER_SIZE,							frame.obs_x, obs_numb * sizeof(float));
+	std::memcpy(payload + TELEMETRY_HEADER_SIZE + obs_numb * sizeof(float), frame.obs_y, obs_numb * sizeof(float));
+
+	return TELEMETRY_HEADER_SIZE + 2 * sizeof(float) * obs_numb;
+}
+/**
+ * decode_telemetry Parses a payload written by encode_telemetry().
+ * @output False if the payload size does not match its observation count
+ */
+inline bool decode_telemetry(const char *payload, const size_t &size, TelemetryFrame &frame)
+{
+	if (size < TELEMETRY_HEADER_SIZE)
+		return false;
+
+	std::memcpy(&frame, payload, TELEMETRY_HEADER_SIZE);
+
+	if (frame.obs_numb > TELEMETRY_MAX_OBSERVATIONS || size != TELEMETRY_HEADER_SIZE + 2 * sizeof(float) * frame.obs_numb)
+		return false;
+
+	std::memcpy(frame.obs_x, payload + TELEMETRY_HEADER_SIZE,								   frame.obs_numb * sizeof(float));
+	std::memcpy(frame.obs_y, payload + TELEMETRY_HEADER_SIZE + frame.obs_numb * sizeof(float), frame.obs_numb * sizeof(float));
+	return true;
+}
+
+#endif /* __TELEMETRY_H__ */
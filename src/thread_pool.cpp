@@ -0,0 +1,116 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	job_ready.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); ++i)
+		workers[i].join();
+}
+void ThreadPool::start(unsigned int threads_numb)
+{
+	if (threads_numb == 0)
+		threads_numb = std::max(1u, std::thread::hardware_concurrency());
+
+	for (unsigned int i = workers.size() + 1; i < threads_numb; ++i)
+		workers.push_back(std::thread(&ThreadPool::worker, this, i));
+}
+unsigned int ThreadPool::size() const
+{
+	return workers.size() + 1;
+}
+bool ThreadPool::pin(const unsigned int &index, const std::vector<unsigned int> &cpus)
+{
+	if (index > workers.size() || cpus.empty())
+		return false;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+
+	for (unsigned int i = 0; i < cpus.size(); ++i)
+		if (cpus[i] < CPU_SETSIZE)
+			CPU_SET(cpus[i], &set);
+
+	return pthread_setaffinity_np(index ? workers[index - 1].native_handle() : pthread_self(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+unsigned int ThreadPool::dispatch(const unsigned int &n, const unsigned int &grain, Job job_fn, void *job_context)
+{
+	const unsigned int chunks = std::max(1u, std::min(size(), (n + std::max(1u, grain) - 1) / std::max(1u, grain)));
+
+	if (chunks == 1)
+	{
+		job_fn(job_context, 0, 0, n);
+		return 1;
+	}
+
+	std::lock_guard<std::mutex> dispatch_lock(dispatch_mutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job			= job_fn;
+		context		= job_context;
+		job_size	= n;
+		chunks_numb = chunks;
+		job_stage	= alloc_stats::current();
+		pending		= chunks - 1;
+		++generation;
+	}
+	job_ready.notify_all();
+
+	run_chunk(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	job_done.wait(lock, [this] { return pending == 0; });
+
+	return chunks;
+}
+void ThreadPool::run_chunk(const unsigned int &chunk)
+{
+	const unsigned int begin = static_cast<unsigned long>(job_size) * chunk		  / chunks_numb;
+	const unsigned int end	 = static_cast<unsigned long>(job_size) * (chunk + 1) / chunks_numb;
+
+	job(context, chunk, begin, end);
+}
+void ThreadPool::worker(const unsigned int &index)
+{
+	unsigned long		seen  = 0;
+	alloc_stats::Stage	stage = alloc_stats::STAGE_OTHER;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_ready.wait(lock, [&] { return stop || generation != seen; });
+
+			if (stop)
+				return;
+
+			seen  = generation;
+			stage = job_stage;
+			if (index >= chunks_numb)
+				continue;
+		}
+
+		// Allocations of the chunk are charged to the stage the loop was dispatched from
+		{
+			alloc_stats::Scope alloc_scope(stage);
+			run_chunk(index);
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--pending == 0)
+			job_done.notify_one();
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "alloc_stats.h"
+
+/*
+ * Fixed set of worker threads running data-parallel loops. The calling thread
+ * takes part as worker 0. Jobs are passed as a function pointer plus context
+ * rather than a std::function, so dispatching a loop never allocates. Several
+ * threads may share one pool, their loops then run one after the other.
+ */
+class ThreadPool
+{
+public:
+	ThreadPool() : job(nullptr), context(nullptr), job_size(0), chunks_numb(0), job_stage(alloc_stats::STAGE_OTHER), generation(0), pending(0), stop(false) {}
+	~ThreadPool();
+	/**
+	 * start Spawns the workers.
+	 * @param threads_numb Total number of threads including the caller, 0 uses all hardware threads
+	 */
+	void start(unsigned int threads_numb);
+	/**
+	 * size Returns the number of threads taking part in a loop, including the caller.
+	 */
+	unsigned int size() const;
+	/**
+	 * pin Restricts thread index (0 .. size() - 1, 0 is the calling thread) to cpus.
+	 *   Chunk k of a loop always runs on thread k, so data a chunk touches first stays local.
+	 * @output False where affinity is not supported or the call failed
+	 */
+	bool pin(const unsigned int &index, const std::vector<unsigned int> &cpus);
+	/**
+	 * parallel_for Splits [0,n) into contiguous chunks of at least grain elements and runs
+	 *   task(chunk, begin, end) for each of them, blocking until all chunks are done.
+	 * @return Number of chunks used, chunk indices are [0, returned value)
+	 */
+	template<typename Task>
+	unsigned int parallel_for(const unsigned int &n, const unsigned int &grain, Task &task)
+	{
+		return dispatch(n, grain, &invoke<Task>, &task);
+	}
+private:
+	typedef void (*Job)(void *context, unsigned int chunk, unsigned int begin, unsigned int end);
+
+	template<typename Task>
+	static void invoke(void *context, unsigned int chunk, unsigned int begin, unsigned int end)
+	{
+		(*static_cast<Task*>(context))(chunk, begin, end);
+	}
+
+	unsigned int dispatch	(const unsigned int &n, const unsigned int &grain, Job job, void *context);
+	void run_chunk			(const unsigned int &chunk);
+	void worker				(const unsigned int &index);
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	std::vector<std::thread>	workers;
+
+	std::mutex					dispatch_mutex;		// Held by the thread whose loop is running
+	std::mutex					mutex;
+	std::condition_variable		job_ready;
+	std::condition_variable		job_done;
+
+	Job							job;
+	void*						context;
+	unsigned int				job_size;
+	unsigned int				chunks_numb;
+	alloc_stats::Stage			job_stage;		// Allocation stage of the dispatching thread
+	unsigned long				generation;
+	unsigned int				pending;
+	bool						stop;
+};
+
+#endif /* __THREAD_POOL_H__ */